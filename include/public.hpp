@@ -17,6 +17,15 @@ enum EnMsgType {
     CREATE_GROUP_MSG, // 创建群组
     ADD_GROUP_MSG,    // 加入群组
     GROUP_CHAT_MSG,   // 群聊天
+
+    MAX_MSG_TYPE, // 消息类型的上限，新增消息类型必须加在它前面
 };
 
+// 消息帧格式：4字节网络字节序的消息体长度 + json消息体
+const int MSG_HEADER_LEN = 4;
+// 客户端发给服务器的单个消息体的最大长度，超过认为是非法数据
+const int MSG_MAX_LEN = 64 * 1024;
+// 服务器发给客户端的单个消息体的最大长度，登录响应中带有好友、群组列表和部分离线消息
+const int MSG_MAX_RESPONSE_LEN = 16 * 1024 * 1024;
+
 #endif // __PUBLIC_H__
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef __BATCHFLUSHER_H__
+#define __BATCHFLUSHER_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// 批量写入器的后台线程，每个时间窗口调用一次写入函数，缓冲区满时可以提前唤醒
+// 写入函数由使用者提供，缓冲区和合并方式由使用者自己维护
+// 作为使用者的最后一个成员声明，保证后台线程启动前和停止后其它成员都有效
+class BatchFlusher {
+public:
+    // 写入一批数据，写入失败返回false
+    using FlushFunc = std::function<bool()>;
+
+    BatchFlusher(int intervalMs, FlushFunc flush);
+    ~BatchFlusher();
+
+    // 使用者向缓冲区追加数据后调用，full表示缓冲区已满
+    // 缓冲区已满时唤醒后台线程立即写入，后台线程已经停止时在调用线程中写入
+    void added(bool full);
+
+    // 在调用线程中立即写入，和后台线程的写入互斥，保证按顺序写入
+    bool flush();
+
+    // 停止后台线程后再写入一次
+    void stop();
+
+private:
+    // 后台线程，每个时间窗口写入一次
+    void flushThread();
+
+    int intervalMs_;
+    FlushFunc flush_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+    bool wakeup_;
+
+    // 保证多次flush按顺序写入
+    std::mutex flushMutex_;
+
+    std::thread thread_;
+};
+
+#endif // __BATCHFLUSHER_H__
@@ -1,31 +1,55 @@
 #ifndef __CHATSERVER_H__
 #define __CHATSERVER_H__
 
+#include "jsoncodec.hpp"
+#include "workerpool.hpp"
+
 #include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThread.h>
 #include <muduo/net/TcpServer.h>
 using namespace muduo;
 using namespace muduo::net;
 // 聊天服务器的主类
 class ChatServer {
 public:
-    // 初始化聊天服务器对象
+    // 初始化聊天服务器对象，nodeid是本服务器节点在集群中的唯一标识
     ChatServer(EventLoop *loop, const InetAddress &listenAddr,
-               const string &nameArg);
+               const string &nameArg, const string &nodeid);
+
+    // 先停止业务线程，再由成员析构停止IO线程
+    ~ChatServer();
 
-    // 启动服务
+    // 启动服务，加入集群成功后才开始接受连接
     void start();
 
 private:
+    // 加入集群，redis不可用时按退避间隔在事件循环中重试
+    void joinCluster();
+
     // 上报连接相关信息的回调函数
     void onConnection(const TcpConnectionPtr &);
 
-    // 上报读写事件相关信息的回调函数
-    void onMessage(const TcpConnectionPtr &, Buffer *, Timestamp);
+    // 编解码器解析出一条完整json消息后的回调函数
+    void onMessage(const TcpConnectionPtr &, json &, Timestamp);
+
+    // 同一个连接上的业务总是交给同一个业务线程，保证处理顺序
+    size_t workerKey(const TcpConnectionPtr &conn) const;
 
-    // 组合的muduo库，实现服务器功能的类对象
-    TcpServer server_;
     // 指向事件循环的指针
     EventLoop *loop_;
+    // 消息帧的编解码器
+    JsonCodec codec_;
+    // 执行业务处理的线程池，IO线程只负责收发数据
+    WorkerPool workerPool_;
+    // 组合的muduo库，实现服务器功能的类对象
+    // IO线程会调用codec_和workerPool_，声明在它们之后，析构时先停止IO线程
+    TcpServer server_;
+    // 节点租约续约专用的线程，不和业务排队，慢业务不会让租约过期
+    EventLoopThread leaseThread_;
+    // 本服务器节点的唯一标识
+    string nodeid_;
+    // 加入集群失败后的重试间隔(秒)
+    double joinRetryDelay_;
 };
 
 #endif // __CHATSERVER_H__
\ No newline at end of file
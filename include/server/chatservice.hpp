@@ -3,29 +3,44 @@
 
 #include "friendmodel.hpp"
 #include "groupmodel.hpp"
+#include "groupmsgmodel.hpp"
 #include "json.hpp"
 #include "offlinemessagemodel.hpp"
+#include "offlinemsgwriter.hpp"
+#include "presencedirectory.hpp"
+#include "public.hpp"
 #include "redis.hpp"
+#include "userconnectionmap.hpp"
 #include "usermodel.hpp"
+#include "userstatewriter.hpp"
 
-#include <functional>
+#include <atomic>
 #include <muduo/net/TcpConnection.h>
-#include <mutex>
-#include <unordered_map>
 
 using namespace muduo;
 using namespace muduo::net;
 using json = nlohmann::json;
 
+class ChatService;
+struct ChatSession;
+
 // 表示处理消息的事件回调方法类型
-using MsgHandler =
-    std::function<void(const TcpConnectionPtr &conn, json &js, Timestamp time)>;
+using MsgHandler = void (ChatService::*)(const TcpConnectionPtr &conn,
+                                         json &js, Timestamp time);
 
 // 聊天服务器业务类
 class ChatService {
 public:
     // 获取单例对象的接口函数
     static ChatService *instance();
+    // 设置跨节点消息的投递方式，必须在init之前调用
+    void setDeliveryMode(Redis::DeliveryMode mode);
+    // 初始化集群通信，nodeid是本服务器节点在集群中的唯一标识
+    // redis暂时不可用时各连接在后台重连，之后需要调用joinCluster加入集群
+    void init(const std::string &nodeid);
+    // 加入集群：清理本节点上次运行遗留的在线用户，取得本节点的租约，redis不可用时返回false
+    // 加入集群之前不能接受登录，否则无法保证同一用户不会在多个节点重复登录
+    bool joinCluster();
     // 处理登录业务
     void login(const TcpConnectionPtr &conn, json &js, Timestamp time);
     // 处理注册业务
@@ -42,36 +57,71 @@ public:
     void groupChat(const TcpConnectionPtr &conn, json &js, Timestamp time);
     // 处理注销业务
     void loginout(const TcpConnectionPtr &conn, json &js, Timestamp time);
-    // 处理客户端异常退出
+    // 处理客户端异常退出，在连接所属的IO线程中调用
     void clientCloseException(const TcpConnectionPtr &conn);
     // 服务器异常，业务重置方法
     void reset();
+    // 定时续约本节点在在线用户目录中的租约，并清理租约过期节点上的用户
+    void keepAlive();
 
     // 从redis消息队列中获取订阅的消息
-    void handleRedisSubscribeMessage(int userid ,std::string msg);
+    void handleRedisSubscribeMessage(const std::string &envelope);
+
+    // 把消息分发给msgid对应的业务处理方法
+    void dispatch(int msgid, const TcpConnectionPtr &conn, json &js,
+                  Timestamp time);
+
+    // msgid的业务处理方法不会阻塞，可以直接在IO线程中执行
+    bool handledInLoop(int msgid) const;
 
-    // 获取消息对应的处理器
-    MsgHandler getHandler(int msgid);
+    // 获取msgid消息的累计处理次数，msgid越界时返回没有处理器的消息数
+    uint64_t getMsgCount(int msgid) const;
+
+    // 把各种消息的累计处理次数输出到日志
+    void logMsgCount() const;
 
 private:
     ChatService();
-    // 存储消息id和其对应的业务处理方法
-    std::unordered_map<int, MsgHandler> msgHandlerMap_;
 
-    // 存储在线用户的通信连接
-    std::unordered_map<int, TcpConnectionPtr> userConnectionMap_;
+    // 登录校验通过并在在线用户目录中登记后，在IO线程中完成登录
+    void loginAuthed(const TcpConnectionPtr &conn, const User &user,
+                     long long epoch);
+
+    // 登录响应发出后再拉取一次离线消息，补发登录过程中存为离线消息的消息
+    void fetchLateOfflineMsgs(const TcpConnectionPtr &conn, int userid);
+
+    // 在IO线程中结束会话的本次登录，撤销在线登记，把用户置为offline
+    void logout(const TcpConnectionPtr &conn, ChatSession *session);
 
-    // 互斥锁，保证userConnectionMap_的线程安全
-    std::mutex connMutex_;
+    // 每种消息的累计处理次数，按msgid下标索引
+    std::atomic<uint64_t> msgCount_[MAX_MSG_TYPE];
+    // 没有对应处理器的消息数
+    std::atomic<uint64_t> unknownMsgCount_;
+
+    // 存储在线用户的通信连接，内部分片加锁保证线程安全
+    UserConnectionMap userConnectionMap_;
 
     // 数据操作类对象
     UserModel userModel_;
     OfflineMsgModel offlineMsgModel_;
     FriendModel friendModel_;
     GroupModel groupModel_;
+    GroupMsgModel groupMsgModel_;
+
+    // 离线消息的批量写入器
+    OfflineMsgWriter offlineMsgWriter_;
+
+    // 用户状态的合并写入器，上下线风暴时同一用户的多次状态变化只写入最后一次
+    UserStateWriter userStateWriter_;
 
     // redis操作对象
     Redis redis_;
+
+    // 集群在线用户目录，判断用户是否在线、在哪个服务器节点上
+    PresenceDirectory presence_;
+
+    // 本服务器节点的唯一标识
+    std::string nodeid_;
 };
 
 #endif // __CHATSERVICE_H__
\ No newline at end of file
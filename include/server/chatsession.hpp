@@ -0,0 +1,26 @@
+#ifndef __CHATSESSION_H__
+#define __CHATSESSION_H__
+
+#include "dbexecutor.hpp"
+
+// 保存在TcpConnection上下文中的会话信息，连接断开时不需要再查找连接属于哪个用户
+// 只在连接所属的IO线程中读写
+struct ChatSession {
+    enum State {
+        CONNECTED, // 已建立连接，尚未登录
+        LOGINING,  // 正在登录，等待数据库线程的执行结果
+        LOGIN,     // 已登录
+        LOGINOUT,  // 已注销
+    };
+
+    int userid = -1;
+    State state = CONNECTED;
+    // 在线用户目录分配的本次登录的会话纪元，登录校验通过之前为0
+    long long epoch = 0;
+    // 登录过程中收到了注销请求，登录完成后立即注销
+    bool loginoutPending = false;
+    // 正在等待数据库线程执行的登录请求
+    DBRequestPtr request;
+};
+
+#endif // __CHATSESSION_H__
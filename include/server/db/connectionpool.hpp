@@ -0,0 +1,60 @@
+#ifndef __CONNECTIONPOOL_H__
+#define __CONNECTIONPOOL_H__
+
+#include "db.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// MySQL连接池，所有Model通过它获取数据库连接，避免每次操作都重新建立连接
+class ConnectionPool {
+public:
+    // 获取连接池单例对象
+    static ConnectionPool *instance();
+
+    // 从连接池中获取一个可用连接，超时返回nullptr
+    // 返回的智能指针析构时，连接自动归还到连接池
+    // 当前线程绑定了连接时，直接返回绑定的连接
+    std::shared_ptr<MySQL> getConnection();
+
+    // 把连接绑定到当前线程，绑定期间本线程的所有数据库操作共用这个连接，conn为空时解除绑定
+    static void bindThreadConnection(std::shared_ptr<MySQL> conn);
+
+private:
+    ConnectionPool();
+    ~ConnectionPool();
+
+    // 创建一个新的数据库连接，失败返回nullptr
+    MySQL *createConnection();
+
+    // 归还连接到空闲队列，已经断开的连接直接销毁
+    void releaseConnection(MySQL *conn);
+
+    // 在独立线程中回收空闲时间超过_maxIdleTime的连接
+    void scannerConnectionTask();
+
+    int _initSize;          // 连接池初始连接量，回收时保留的最小连接量
+    int _maxSize;           // 连接池最大连接量
+    int _maxIdleTime;       // 连接最大空闲时间(ms)
+    int _connectionTimeout; // 获取连接的超时时间(ms)
+    int _pingIdleTime;      // 连接空闲超过该时长(ms)，取出时先做健康检查
+
+    // 空闲连接队列，尾部是最近归还的连接，头部是空闲最久的连接
+    std::deque<MySQL *> _connQue;
+    // 当前已创建的连接总数(空闲 + 使用中)
+    int _connCnt;
+    // 保证连接队列和计数线程安全的互斥锁
+    std::mutex _queueMutex;
+    // 连接归还时通知等待获取连接的线程
+    std::condition_variable _cv;
+
+    // 回收空闲连接的线程
+    std::thread _scanner;
+    std::condition_variable _scannerCv;
+    bool _stop;
+};
+
+#endif // __CONNECTIONPOOL_H__
@@ -3,7 +3,59 @@
 
 
 #include <mysql/mysql.h>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+class MySQL;
+
+// 预处理语句，由MySQL连接按sql文本缓存复用，参数和结果都以二进制格式传输
+class MySQLStmt
+{
+public:
+    MySQLStmt(MySQL *owner, MYSQL_STMT *stmt);
+    ~MySQLStmt();
+    // 准备结果集的接收缓冲区
+    bool init();
+    // 设置第index个参数（从0开始），字符串参数只保存指针，执行完之前不能释放
+    void setInt(int index, long long value);
+    void setString(int index, const std::string &value);
+    // 执行语句，查询语句的结果集一次性读取到客户端
+    bool execute();
+    // 读取结果集的下一行，没有更多的行返回false
+    bool fetch();
+    // 读取当前行第index列的值，值为NULL时返回0或空字符串
+    long long getInt(int index) const;
+    std::string getString(int index) const;
+    // 查询语句结果集的行数
+    long long rowCount();
+    // insert语句生成的自增主键
+    long long insertId();
+    // 语句影响的行数
+    long long affectedRows();
+private:
+    // 结果列的接收缓冲区，整数列按整数接收，其它列按字符串接收
+    struct Column
+    {
+        bool isInt = false;
+        long long intValue = 0;
+        std::vector<char> buffer;
+        unsigned long length = 0;
+        bool isNull = false;
+        bool error = false;
+    };
+
+    // 语句所属的连接，执行出错时检查连接是否已经断开
+    MySQL *_owner;
+    MYSQL_STMT *_stmt;
+    std::vector<MYSQL_BIND> _params;
+    std::vector<long long> _intParams;
+    std::vector<unsigned long> _paramLengths;
+    std::vector<MYSQL_BIND> _results;
+    std::vector<Column> _columns;
+};
 
 // 数据库操作类
 class MySQL
@@ -21,9 +73,32 @@ public:
     MYSQL_RES *query(std::string sql);
     // 获取连接
     MYSQL* getConnection();
+    // 获取sql对应的预处理语句，同一连接上相同的sql只在第一次使用时准备，失败返回nullptr
+    MySQLStmt *prepare(const std::string &sql);
+    // 生成count个以','分隔的参数占位符
+    static std::string placeholders(size_t count);
+    // 检测连接是否可用
+    bool ping();
+    // 刷新连接进入空闲状态的时间点
+    void refreshAliveTime();
+    // 返回连接已经空闲的时长(ms)
+    long long getIdleTime() const;
+    // 连接是否已经断开，断开的连接和其上缓存的预处理语句都不能再使用
+    bool isBroken() const;
 private:
+    friend class MySQLStmt;
+
+    // 根据错误码判断连接是否断开，是连接级错误时标记为断开
+    void checkError(unsigned int err);
+
     MYSQL *_conn;
+    // 执行中出现过连接级错误
+    bool _broken;
+    // 本连接上已经准备好的语句，sql文本 -> 语句
+    std::unordered_map<std::string, std::unique_ptr<MySQLStmt>> _stmts;
+    // 连接进入空闲状态的时间点
+    std::chrono::steady_clock::time_point _aliveTime;
 };
 
 
-#endif // __DB_H__
\ No newline at end of file
+#endif // __DB_H__
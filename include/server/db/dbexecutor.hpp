@@ -0,0 +1,81 @@
+#ifndef __DBEXECUTOR_H__
+#define __DBEXECUTOR_H__
+
+#include <muduo/net/EventLoop.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using muduo::net::EventLoop;
+
+// 提交给数据库线程的一个请求，可以在开始执行之前取消
+class DBRequest {
+public:
+    // 取消还没有开始执行的请求，取消后不再执行也不回调，已经开始执行返回false
+    bool cancel();
+
+private:
+    friend class DBExecutor;
+
+    enum State { kPending, kRunning, kCancelled };
+
+    std::atomic<int> _state{kPending};
+    // 执行前是否先从连接池取得连接
+    bool _bindConnection = true;
+    EventLoop *_loop = nullptr;
+    std::function<void()> _query;
+    std::function<void(bool)> _done;
+    // 开始执行的期限，没有期限时为time_point::max()
+    std::chrono::steady_clock::time_point _deadline;
+};
+
+using DBRequestPtr = std::shared_ptr<DBRequest>;
+
+// 异步数据库执行器，数据库操作在独立的数据库线程中执行，完成后回到调用者的EventLoop中回调
+// 调用者不用为了等待数据库响应阻塞IO线程或业务线程
+class DBExecutor {
+public:
+    using Query = std::function<void()>;
+    // ok为false表示请求超过期限没有执行，或者没有可用的数据库连接
+    using Callback = std::function<void(bool ok)>;
+
+    // 请求执行时的连接方式
+    // kBindConnection：先从连接池取得连接，执行期间线程上的Model操作共用这个连接，取不到时不执行
+    // kNoConnection：不取连接直接执行，用于撤销在线登记这类不能因为MySQL不可用而跳过的请求
+    //                其中的Model操作各自从连接池取连接，取不到时只有这一步失败
+    enum ConnectionPolicy { kBindConnection, kNoConnection };
+
+    // 获取执行器单例对象
+    static DBExecutor *instance();
+
+    // 提交请求：query在数据库线程中执行，完成后done在loop线程中回调
+    // timeoutMs大于0时，超过期限还没有开始执行的请求不再执行
+    DBRequestPtr submit(EventLoop *loop, Query query, Callback done,
+                        int timeoutMs = 0,
+                        ConnectionPolicy policy = kBindConnection);
+
+private:
+    DBExecutor();
+    ~DBExecutor();
+
+    // 数据库线程的执行函数，循环取出请求执行
+    void threadFunc();
+
+    // 在请求的loop中回调执行结果
+    static void complete(const DBRequestPtr &request, bool ok);
+
+    std::vector<std::thread> _threads;
+    std::deque<DBRequestPtr> _queue;
+    std::mutex _queueMutex;
+    std::condition_variable _cv;
+    bool _stop;
+};
+
+#endif // __DBEXECUTOR_H__
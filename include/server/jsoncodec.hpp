@@ -0,0 +1,44 @@
+#ifndef __JSONCODEC_H__
+#define __JSONCODEC_H__
+
+#include "json.hpp"
+
+#include <functional>
+#include <memory>
+#include <muduo/net/TcpConnection.h>
+
+using namespace muduo;
+using namespace muduo::net;
+using json = nlohmann::json;
+
+// 收到一条完整json消息的回调类型
+using JsonMessageCallback =
+    std::function<void(const TcpConnectionPtr &conn, json &js, Timestamp time)>;
+
+// 长度头 + json消息体 的编解码器，解决TCP粘包和半包问题
+class JsonCodec {
+public:
+    explicit JsonCodec(const JsonMessageCallback &cb);
+
+    // 从Buffer中解析出所有完整的消息帧，不完整的帧留在Buffer中等待后续数据
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buffer,
+                   Timestamp time);
+
+    // 给消息体加上长度头后发送，在其它线程调用时和sendFrame一样通过LoopInbox投递
+    static void send(const TcpConnectionPtr &conn, const std::string &msg);
+
+    // 编码出带长度头的完整消息帧，群发时所有连接共享同一份只读数据
+    static std::shared_ptr<const std::string> encode(const std::string &msg);
+    static std::shared_ptr<const std::string> encode(const char *data,
+                                                     size_t len);
+
+    // 发送encode编码好的消息帧，在连接所属的loop中直接写出，不再拷贝消息数据
+    // 在其它线程调用时，通过该loop的LoopInbox批量投递
+    static void sendFrame(const TcpConnectionPtr &conn,
+                          const std::shared_ptr<const std::string> &frame);
+
+private:
+    JsonMessageCallback messageCallback_;
+};
+
+#endif // __JSONCODEC_H__
@@ -0,0 +1,41 @@
+#ifndef __LOOPINBOX_H__
+#define __LOOPINBOX_H__
+
+#include "mpscqueue.hpp"
+
+#include <memory>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+#include <string>
+#include <utility>
+
+using namespace muduo;
+using namespace muduo::net;
+
+// IO线程的投递队列
+// 其它线程发给该IO线程上连接的消息先放入无锁队列，队列由空变为非空时才唤醒一次IO线程，
+// IO线程一次取出本轮积攒的全部消息，在自己的线程中直接写入连接
+class LoopInbox {
+public:
+    // 为IO线程创建投递队列，在TcpServer的线程初始化回调中调用
+    static void create(EventLoop *loop);
+
+    // 查找IO线程的投递队列，没有时返回nullptr，可以和create并发调用
+    static LoopInbox *find(EventLoop *loop);
+
+    // 投递一条已经编码好的消息帧，可以在任意线程调用
+    void post(const TcpConnectionPtr &conn,
+              const std::shared_ptr<const std::string> &frame);
+
+private:
+    explicit LoopInbox(EventLoop *loop);
+
+    // 在IO线程中取出全部消息并发送
+    void drain();
+
+    EventLoop *loop_;
+    MpscQueue<std::pair<TcpConnectionPtr, std::shared_ptr<const std::string>>>
+        queue_;
+};
+
+#endif // __LOOPINBOX_H__
@@ -0,0 +1,34 @@
+#ifndef __GROUPMSGMODEL_H__
+#define __GROUPMSGMODEL_H__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 群消息记录表的操作接口方法
+// 每条群消息只存储一份，用户在每个群里有一个读游标，登录时拉取游标之后的群消息
+class GroupMsgModel {
+public:
+    // 存储一条群消息，返回消息的序号，失败返回-1
+    long long insert(int groupid, const std::string &msg);
+
+    // 查询用户所在的所有群组中，读游标之后的群消息，按序号排列
+    // cursors返回各群组中实际读到的最大序号，groupid -> msgid
+    std::vector<std::string> query(int userid,
+                                   std::unordered_map<int, long long> &cursors);
+
+    // 把用户在所有群组中的读游标移动到最新的群消息
+    void updateCursor(int userid);
+
+    // 把用户在指定群组中的读游标移动到最新的群消息，用于新加入群组的用户
+    void updateCursor(int userid, int groupid);
+
+    // 把用户在各群组中的读游标移动到query返回的序号，读游标只前进不后退
+    void updateCursor(int userid,
+                      const std::unordered_map<int, long long> &cursors);
+
+    // 删除用户所在的群组中所有成员都已经读过的群消息，在读游标移动后调用
+    void prune(int userid);
+};
+
+#endif // __GROUPMSGMODEL_H__
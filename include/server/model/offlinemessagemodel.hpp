@@ -2,19 +2,25 @@
 #define __OFFLINEMESSAGEMODEL_H__
 
 #include <string>
+#include <utility>
 #include <vector>
 
 // 提供离线消息表的操作接口方法
 class OfflineMsgModel {
 public:
     // 存储用户的离线消息
-    void insert(int userid, std::string msg);
+    void insert(int userid, const std::string &msg);
 
-    // 删除用户的离线消息
-    void remove(int userid);
-    
-    // 查询用户的离线消息
-    std::vector<std::string> query(int userid);
+    // 批量存储离线消息<userid, msg>，在一个事务中用多行insert写入
+    // 返回false表示没有可用的连接或者连接已经断开，所有消息都没有写入，可以稍后重试
+    // 个别消息本身写不进去时逐行写入，写不进去的消息记录日志后丢弃，仍然返回true
+    bool insert(const std::vector<std::pair<int, std::string>> &msgVec);
+
+    // 删除用户序号不超过maxid的离线消息，只删除已经读到的，之后写入的留给下次读取
+    bool remove(int userid, long long maxid);
+
+    // 查询用户的离线消息，按写入顺序排列，maxid返回读到的最大序号，没有消息时为0
+    std::vector<std::string> query(int userid, long long &maxid);
 
 private:
 };
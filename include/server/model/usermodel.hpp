@@ -3,6 +3,9 @@
 
 #include "user.hpp"
 
+#include <utility>
+#include <vector>
+
 // User表的数据操作类
 class UserModel {
 public:
@@ -15,8 +18,10 @@ public:
     // 更新用户的状态信息
     bool updateState(User user);
 
-    // 重置用户的状态信息
-    void resetState();
+    // 把登录会话<userid, 会话纪元>的状态批量更新为state
+    // 只更新记录的纪元不比会话新的用户，其它节点上之后的登录写入的状态不会被覆盖
+    bool updateState(const std::vector<std::pair<int, long long>> &sessions,
+                     const std::string &state);
 };
 
 #endif // __USERMODEL_H__
\ No newline at end of file
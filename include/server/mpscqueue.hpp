@@ -0,0 +1,71 @@
+#ifndef __MPSCQUEUE_H__
+#define __MPSCQUEUE_H__
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+// 多生产者单消费者的无锁队列
+// 生产者通过CAS把节点压入链表头部，消费者一次取走整条链表并反转成入队顺序
+// 消费者只做整体交换，不会单独弹出节点，因此不存在ABA问题
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head_(nullptr) {}
+
+    ~MpscQueue() {
+        Node *node = head_.load(std::memory_order_acquire);
+        while (node != nullptr) {
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // 入队，可以在任意线程中调用
+    // 返回入队前队列是否为空，为空时调用者负责唤醒消费者，避免每个元素都唤醒一次
+    bool push(T value) {
+        Node *node = new Node{std::move(value), nullptr};
+        Node *old = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = old;
+        } while (!head_.compare_exchange_weak(old, node,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+        return old == nullptr;
+    }
+
+    // 取出队列中的全部元素，按入队顺序追加到vec中，只能在消费者线程中调用
+    void popAll(std::vector<T> &vec) {
+        Node *node = head_.exchange(nullptr, std::memory_order_acquire);
+
+        // 链表是后进先出的顺序，先反转
+        Node *prev = nullptr;
+        while (node != nullptr) {
+            Node *next = node->next;
+            node->next = prev;
+            prev = node;
+            node = next;
+        }
+
+        while (prev != nullptr) {
+            Node *next = prev->next;
+            vec.push_back(std::move(prev->value));
+            delete prev;
+            prev = next;
+        }
+    }
+
+private:
+    struct Node {
+        T value;
+        Node *next;
+    };
+
+    std::atomic<Node *> head_;
+};
+
+#endif // __MPSCQUEUE_H__
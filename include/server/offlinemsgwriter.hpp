@@ -0,0 +1,41 @@
+#ifndef __OFFLINEMSGWRITER_H__
+#define __OFFLINEMSGWRITER_H__
+
+#include "batchflusher.hpp"
+#include "offlinemessagemodel.hpp"
+
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 离线消息的批量写入器
+// 离线消息先放入缓冲区，由后台线程按时间窗口或数量阈值合并成多行insert写入MySQL
+class OfflineMsgWriter {
+public:
+    OfflineMsgWriter();
+
+    // 追加一条用户的离线消息
+    void append(int userid, const std::string &msg);
+
+    // 立即把缓冲区中的离线消息写入MySQL，返回时已经写入完成
+    // 写入失败返回false，失败的消息留在缓冲区中，由后台线程重试
+    bool flush() { return flusher_.flush(); }
+
+    // 写入剩余的离线消息后停止后台线程
+    void stop() { flusher_.stop(); }
+
+private:
+    // 写入缓冲区中的离线消息，由flusher_调用
+    bool write();
+
+    OfflineMsgModel offlineMsgModel_;
+
+    // 等待写入的离线消息<userid, msg>
+    std::vector<std::pair<int, std::string>> pending_;
+    std::mutex mutex_;
+
+    BatchFlusher flusher_;
+};
+
+#endif // __OFFLINEMSGWRITER_H__
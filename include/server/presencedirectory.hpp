@@ -0,0 +1,88 @@
+#ifndef __PRESENCEDIRECTORY_H__
+#define __PRESENCEDIRECTORY_H__
+
+#include "redis.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 集群在线用户目录，记录用户登录在哪个服务器节点上
+// 目录保存在redis中，查询时经过本地缓存，发消息给其它节点的用户不再访问mysql
+class PresenceDirectory {
+public:
+    // 节点租约的续约间隔（秒），远小于租约有效期，偶尔一次续约失败不会被其它节点清理
+    static constexpr double kLeaseRenewInterval = 3.0;
+
+    explicit PresenceDirectory(Redis &redis);
+
+    // 登记用户登录在node上，返回本次登录的会话纪元
+    // 用户已经在线返回0，目录不可用返回-1
+    long long claim(int userid, const std::string &node);
+
+    // 删除用户在node上纪元为epoch的这次登录
+    bool release(int userid, const std::string &node, long long epoch);
+
+    // 查询用户所在的服务器节点，不在线返回空字符串
+    std::string lookup(int userid);
+
+    // 批量查询用户所在的服务器节点，结果和userids一一对应，缓存未命中的用户合并成一次查询
+    std::vector<std::string> lookup(const std::vector<int> &userids);
+
+    // 节点加入集群：清理node上次运行遗留的会话（放入swept）后取得租约，redis不可用返回false
+    bool join(const std::string &node,
+              std::vector<std::pair<int, long long>> &swept);
+
+    // 续约node的租约，租约已经过期（本节点的用户可能已被清理）时重新取得租约并返回false
+    bool renewLease(const std::string &node);
+
+    // 租约过期后重新登记node上仍然在线的用户会话<userid, 会话纪元>
+    void restore(const std::string &node,
+                 const std::vector<std::pair<int, long long>> &sessions);
+
+    // 清理node自己登记的用户并删除它的租约，返回被清理的会话<userid, 会话纪元>
+    std::vector<std::pair<int, long long>> sweep(const std::string &node);
+
+    // 清理租约过期的节点上登记的用户，返回被清理的会话<userid, 会话纪元>，被清理的节点放入expiredNodes
+    std::vector<std::pair<int, long long>>
+    sweepExpired(std::vector<std::string> &expiredNodes);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // 缓存在线用户所在的节点，缓存过期前用户换了节点时，消息发到旧节点后转为离线消息
+    static constexpr std::chrono::milliseconds kCacheTtl{1000};
+    // 不在线的结果只短暂缓存，给离线用户连续发消息时不必每条都查询redis
+    // 用户刚登录时发给他的消息可能因此存为离线消息，登录响应发出后会再拉取一次离线消息
+    static constexpr std::chrono::milliseconds kOfflineCacheTtl{200};
+    // 节点租约的有效期，节点停止续约超过这个时间后，其上的用户被其它节点清理
+    static const int kLeaseTtlMs = 10000;
+    static const int kShardNum = 32;
+
+    struct CacheEntry {
+        std::string node;
+        Clock::time_point expire;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<int, CacheEntry> entries;
+    };
+
+    Shard &shard(int userid) {
+        return shards_[static_cast<unsigned>(userid) % kShardNum];
+    }
+
+    // 查询本地缓存，命中返回true，node为空表示用户不在线
+    bool findCache(int userid, Clock::time_point now, std::string &node);
+    // 更新本地缓存，node为空表示用户不在线
+    void updateCache(int userid, const std::string &node, Clock::time_point now);
+
+    Redis &redis_;
+    Shard shards_[kShardNum];
+};
+
+#endif // __PRESENCEDIRECTORY_H__
@@ -1,10 +1,25 @@
 #ifndef REDIS_H
 #define REDIS_H
 
+#include "mpscqueue.hpp"
 #include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThread.h>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 using namespace std;
+using namespace muduo::net;
 
 /*
 redis作为集群服务器通信的基于发布-订阅消息队列时，会遇到两个难搞的bug问题，参考我的博客详细描述：
@@ -13,36 +28,180 @@ https://blog.csdn.net/QIANGWEIYUAN/article/details/97895611
 class Redis
 {
 public:
+    // 跨节点消息的投递方式
+    enum DeliveryMode
+    {
+        PUBSUB, // 发布-订阅，不落盘，订阅方不在线时消息丢失
+        STREAM, // 每个通道对应一个Stream，消费组批量读取并确认，未确认的消息重启后重新投递
+    };
+
     Redis();
     ~Redis();
 
-    // 连接redis服务器 
+    // 设置投递方式，必须在connect之前调用
+    void setDeliveryMode(DeliveryMode mode);
+
+    // 连接redis服务器，redis暂时不可用时返回false
+    // 无论是否连接成功，各个连接都会在后台按退避间隔重连，连接恢复后重新订阅所有通道
     bool connect();
 
     // 向redis指定的通道channel发布消息
-    bool publish(int channel, string message);
+    bool publish(const string &channel, const string &message);
 
-    // 向redis指定的通道subscribe订阅消息
-    bool subscribe(int channel);
+    // 向redis指定的通道subscribe订阅消息，订阅连接不可用时记录通道，重连后自动订阅
+    bool subscribe(const string &channel);
 
     // 向redis指定的通道unsubscribe取消订阅消息
-    bool unsubscribe(int channel);
+    bool unsubscribe(const string &channel);
+
+    // 在线用户目录：用户不在线时记录用户所在的服务器节点，返回本次登录的会话纪元
+    // 用户已经在线返回0，redis不可用返回-1
+    long long claimUserNode(int userid, const string &node);
+
+    // 在线用户目录：记录的仍然是node上纪元为epoch的这次登录时才删除，避免误删用户之后的新登录
+    bool delUserNode(int userid, const string &node, long long epoch);
+
+    // 在线用户目录：查询用户所在的服务器节点，不在线返回空字符串
+    string getUserNode(int userid);
+
+    // 在线用户目录：批量查询用户所在的服务器节点，结果和userids一一对应
+    vector<string> getUserNodes(const vector<int> &userids);
+
+    // 节点租约：续约node的租约，返回1；租约已经过期时重新取得租约，返回0；redis不可用返回-1
+    int renewLease(const string &node, int ttlms);
+
+    // 节点租约：租约过期后重新登记node上仍然在线的用户会话<userid, 会话纪元>
+    bool restoreUserNodes(const string &node, const vector<pair<int, long long>> &sessions);
+
+    // 节点租约：删除node自己的租约和登记的所有用户，被删除的会话<userid, 会话纪元>放入sessions
+    // redis不可用返回false，node仍然留在节点集合中，之后由存活节点按租约过期的节点清理
+    bool sweepUserNodes(const string &node, vector<pair<int, long long>> &sessions);
+
+    // 节点租约：删除租约已经过期的节点上登记的所有用户，并把这些节点移出节点集合
+    // 被删除的会话<userid, 会话纪元>放入sessions，被清理的节点放入nodes，redis不可用返回false
+    bool sweepExpiredNodes(vector<pair<int, long long>> &sessions, vector<string> &nodes);
+
+    // STREAM方式下，把已经被清理的节点的Stream中没有处理完的消息交给业务层，然后删除这个Stream
+    // 在观察线程中稍后执行，PUBSUB方式下什么也不做
+    void drainStream(const string &stream);
 
     // 在独立线程中接收订阅通道中的消息
     void observer_channel_message();
 
+    // STREAM方式下在独立线程中批量读取并确认订阅的Stream中的消息
+    void observer_stream_message();
+
     // 初始化向业务层上报通道消息的回调对象
-    void init_notify_handler(function<void(int, string)> fn);
+    void init_notify_handler(function<void(const string &)> fn);
 
 private:
-    // hiredis同步上下文对象，负责publish消息
-    redisContext *_publish_context;
+    // 建立同步上下文连接，连接失败或上下文出错返回nullptr
+    static redisContext *connectContext();
+
+    // 订阅连接断开后重新建立连接，并把所有订阅过的通道一次性重新订阅
+    bool reconnectSubscribeContext();
+
+    // 在观察线程中按退避间隔重连订阅连接，直到连接成功或者停止
+    void waitSubscribeContext();
+
+    // 在subscribe上下文上发送一条命令，不等待响应，调用者需持有_subscribe_mutex
+    bool writeSubscribeCommand(redisContext *context, const vector<string> &args);
+
+    // STREAM方式下为通道创建本节点的消费组
+    static bool createStreamGroup(redisContext *context, const string &stream);
+
+    // 本节点订阅的所有Stream
+    vector<string> subscribedStreams();
 
-    // hiredis同步上下文对象，负责subscribe消息
+    // STREAM方式下一次读取streams中的所有Stream，上报消息后批量确认，返回读到的消息数，出错返回-1
+    int readStreamBatch(const vector<string> &streams, const string &startid, int blockms);
+
+    // 在观察线程中清理到期的过期节点的Stream，出错返回false
+    bool drainStreams();
+
+    // 从命令上下文池中取出一个上下文，都在使用中时等待归还，redis不可用时返回nullptr
+    // 池中的上下文都没有建立时按退避间隔重连，避免redis不可用时每个请求都去连接
+    redisContext *acquireCommandContext();
+
+    // 归还命令上下文，出错的上下文直接释放，下次取用时重新连接
+    void releaseCommandContext(redisContext *context);
+
+    // 取出的命令上下文在析构时归还，get()为nullptr表示redis不可用
+    class CommandContext
+    {
+    public:
+        explicit CommandContext(Redis &redis)
+            : _redis(redis), _context(redis.acquireCommandContext())
+        {
+        }
+        ~CommandContext()
+        {
+            if (_context != nullptr)
+            {
+                _redis.releaseCommandContext(_context);
+            }
+        }
+        redisContext *get() const { return _context; }
+
+    private:
+        Redis &_redis;
+        redisContext *_context;
+    };
+
+    // 在redis事件循环线程中建立publish异步连接
+    void connectPublishContext();
+
+    // publish连接失败或断开后，按退避间隔安排下一次重连
+    void schedulePublishReconnect();
+
+    // 在redis事件循环线程中取出所有待发布的消息，一次性追加到异步上下文中流水线发送
+    void flushPublishQueue();
+
+    // publish异步连接建立、断开和PUBLISH命令响应的回调，redisAsyncContext::data指向Redis对象
+    static void onPublishConnect(const redisAsyncContext *context, int status);
+    static void onPublishDisconnect(const redisAsyncContext *context, int status);
+    static void onPublishReply(redisAsyncContext *context, void *reply, void *privdata);
+
+    // hiredis异步上下文对象，负责publish消息，只能在_loop线程中访问
+    redisAsyncContext *_publish_context;
+
+    // 驱动publish异步上下文的事件循环线程
+    EventLoopThread _loop_thread;
+    EventLoop *_loop;
+
+    // 待发布的消息<channel, message>，各个业务线程无锁入队，由redis事件循环线程批量取出
+    MpscQueue<pair<string, string>> _publish_queue;
+
+    // publish连接断开期间缓存的消息，连接恢复后按顺序补发，只在_loop线程中访问
+    deque<pair<string, string>> _publish_backlog;
+    bool _publish_connected;
+    double _publish_retry_delay;
+
+    DeliveryMode _mode;
+
+    // hiredis同步上下文对象，负责subscribe消息（STREAM方式下负责读取和确认），由观察线程建立，重连时在_subscribe_mutex保护下替换
     redisContext *_subcribe_context;
+    // 当前订阅的所有通道，重连后据此恢复订阅
+    set<string> _channels;
+    // 等待清理的过期节点的Stream -> 开始清理的时间
+    map<string, chrono::steady_clock::time_point> _drain_streams;
+    mutex _subscribe_mutex;
+
+    // hiredis同步上下文对象池，负责在线用户目录的读写，每个上下文同一时刻只由一个线程使用
+    // 业务线程、数据库线程和续约线程各自取用空闲的上下文，一个慢请求不会让其它请求排队
+    vector<redisContext *> _command_contexts;
+    // 已经建立的上下文数量（空闲 + 使用中）
+    int _command_context_count;
+    mutex _command_mutex;
+    condition_variable _command_cv;
+    double _command_retry_delay;
+    chrono::steady_clock::time_point _command_retry_time;
+
+    // 析构时置位，停止所有重连
+    atomic<bool> _stopping;
 
     // 回调操作，收到订阅的消息，给service层上报
-    function<void(int, string)> _notify_message_handler;
+    function<void(const string &)> _notify_message_handler;
 };
 
 #endif
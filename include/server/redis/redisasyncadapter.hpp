@@ -0,0 +1,44 @@
+#ifndef REDISASYNCADAPTER_H
+#define REDISASYNCADAPTER_H
+
+#include <hiredis/async.h>
+#include <memory>
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+/*
+把hiredis异步上下文的socket注册到muduo的EventLoop上，作用和hiredis/adapters目录下的
+libevent、libev适配器相同：hiredis需要监听读写事件时回调addRead/addWrite等函数，
+这里转换成Channel的enableReading/enableWriting，事件就绪时再调用redisAsyncHandleRead/Write
+所有操作都必须在loop线程中执行
+*/
+class RedisAsyncAdapter
+{
+public:
+    // 把异步上下文绑定到loop上，必须在设置连接回调之前调用
+    static bool attach(EventLoop *loop, redisAsyncContext *context);
+
+private:
+    RedisAsyncAdapter(EventLoop *loop, redisAsyncContext *context);
+
+    // hiredis回调的事件注册函数，privdata是RedisAsyncAdapter对象
+    static void addRead(void *privdata);
+    static void delRead(void *privdata);
+    static void addWrite(void *privdata);
+    static void delWrite(void *privdata);
+    static void cleanup(void *privdata);
+
+    // Channel上的读写事件回调
+    void handleRead(Timestamp receiveTime);
+    void handleWrite();
+
+    EventLoop *_loop;
+    // 上下文被hiredis释放后置为nullptr
+    redisAsyncContext *_context;
+    std::unique_ptr<Channel> _channel;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __USERCONNECTIONMAP_H__
+#define __USERCONNECTIONMAP_H__
+
+#include <functional>
+#include <muduo/net/TcpConnection.h>
+#include <mutex>
+#include <unordered_map>
+
+using namespace muduo;
+using namespace muduo::net;
+
+// 在线用户的通信连接表
+// 按userid分成多个分片，每个分片有独立的互斥锁，不同用户的操作不再争抢同一把锁
+class UserConnectionMap {
+public:
+    // 记录用户的连接和本次登录的会话纪元，已存在时覆盖
+    void insert(int userid, const TcpConnectionPtr &conn, long long epoch);
+
+    // 只有记录的连接是conn时才删除，避免误删用户重新登录后的新连接
+    bool erase(int userid, const TcpConnectionPtr &conn);
+
+    // 查询用户的连接，用户不在本服务器返回nullptr
+    TcpConnectionPtr find(int userid) const;
+
+    // 用户纪元为epoch的这次登录是否仍然记录在表中
+    bool contains(int userid, long long epoch) const;
+
+    // 遍历所有在线用户<userid, 连接, 会话纪元>，回调执行期间持有对应分片的锁，回调中不能再访问本对象
+    void forEach(
+        const std::function<void(int, const TcpConnectionPtr &, long long)>
+            &fn) const;
+
+private:
+    static const int kShardNum = 32;
+
+    // 插入时记录会话纪元，其它线程遍历时不需要读取连接上的会话信息
+    struct Entry {
+        TcpConnectionPtr conn;
+        long long epoch;
+    };
+
+    // 按缓存行对齐，避免相邻分片的锁产生伪共享
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<int, Entry> conns;
+    };
+
+    Shard &shard(int userid) {
+        return shards_[static_cast<unsigned>(userid) % kShardNum];
+    }
+    const Shard &shard(int userid) const {
+        return shards_[static_cast<unsigned>(userid) % kShardNum];
+    }
+
+    Shard shards_[kShardNum];
+};
+
+#endif // __USERCONNECTIONMAP_H__
@@ -0,0 +1,56 @@
+#ifndef __USERSTATEWRITER_H__
+#define __USERSTATEWRITER_H__
+
+#include "batchflusher.hpp"
+#include "usermodel.hpp"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 用户状态的合并写入器
+// 状态更新先放入缓冲区，同一用户只保留会话纪元最新的一次，由后台线程按状态分组批量更新MySQL
+// 还没有写入的状态保存在内存中，读取用户状态时优先使用，保证能读到自己的写入
+class UserStateWriter {
+public:
+    UserStateWriter();
+
+    // 更新用户纪元为epoch的这次登录的状态
+    void update(int userid, long long epoch, const std::string &state);
+    // 批量更新登录会话<userid, 会话纪元>的状态
+    void update(const std::vector<std::pair<int, long long>> &sessions,
+                const std::string &state);
+
+    // 返回用户还没有写入MySQL的状态，没有时返回stored
+    std::string state(int userid, const std::string &stored);
+
+    // 立即把缓冲区中的状态写入MySQL，返回时已经写入完成
+    // 写入失败的状态放回缓冲区等待重试，返回false
+    bool flush() { return flusher_.flush(); }
+
+    // 写入剩余的状态后停止后台线程
+    void stop() { flusher_.stop(); }
+
+private:
+    struct PendingState {
+        std::string state;
+        long long epoch;
+    };
+
+    // 写入缓冲区中的状态，由flusher_调用
+    bool write();
+
+    UserModel userModel_;
+
+    // 等待写入的状态 userid -> 状态和会话纪元
+    std::unordered_map<int, PendingState> pending_;
+    // 正在写入的状态，写入完成前仍然作为读取时的覆盖层
+    std::unordered_map<int, PendingState> flushing_;
+    std::mutex mutex_;
+
+    BatchFlusher flusher_;
+};
+
+#endif // __USERSTATEWRITER_H__
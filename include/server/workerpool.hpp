@@ -0,0 +1,44 @@
+#ifndef __WORKERPOOL_H__
+#define __WORKERPOOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 业务线程池，执行会阻塞的业务处理(MySQL、Redis)，避免阻塞muduo的IO线程
+// 每个线程有独立的任务队列，相同key的任务总是投递给同一个线程，保证按投递顺序执行
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkerPool(int threadNum);
+    ~WorkerPool();
+
+    // 启动所有业务线程
+    void start();
+    // 等待已投递的任务执行完毕后停止所有业务线程
+    void stop();
+
+    // 按key选择业务线程执行任务
+    void run(size_t key, Task task);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Task> tasks;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    // 业务线程的执行函数，循环取出任务执行
+    void workerThread(Worker *worker);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+#endif // __WORKERPOOL_H__
@@ -40,6 +40,10 @@ atomic_bool g_isLoginSuccess{false};
 
 // 接收线程
 void readTaskHandler(int clientfd);
+// 按照 长度头+消息体 的帧格式发送一条消息
+int sendMessage(int clientfd, const string &msg);
+// 从连接上读取一条完整的消息帧
+bool recvMessage(int clientfd, string &msg);
 // 获取系统时间（聊天信息需要添加时间信息）
 string getCurrentTime();
 // 主聊天页面程序
@@ -125,7 +129,7 @@ int main(int argc, char **argv)
 
             g_isLoginSuccess = false;
 
-            int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
+            int len = sendMessage(clientfd, request);
             if (len == -1)
             {
                 cerr << "send login msg error:" << request << endl;
@@ -156,7 +160,7 @@ int main(int argc, char **argv)
             js["password"] = pwd;
             string request = js.dump();
 
-            int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
+            int len = sendMessage(clientfd, request);
             if (len == -1)
             {
                 cerr << "send reg msg error:" << request << endl;
@@ -288,9 +292,8 @@ void readTaskHandler(int clientfd)
 {
     for (;;)
     {
-        char buffer[1024] = {0};
-        int len = recv(clientfd, buffer, 1024, 0);  // 阻塞了
-        if (-1 == len || 0 == len)
+        string buffer;
+        if (!recvMessage(clientfd, buffer)) // 阻塞了
         {
             close(clientfd);
             exit(-1);
@@ -329,6 +332,61 @@ void readTaskHandler(int clientfd)
     }
 }
 
+// 按照 长度头+消息体 的帧格式发送一条消息
+int sendMessage(int clientfd, const string &msg)
+{
+    uint32_t len = htonl(static_cast<uint32_t>(msg.size()));
+    string frame(reinterpret_cast<const char *>(&len), MSG_HEADER_LEN);
+    frame += msg;
+
+    size_t sent = 0;
+    while (sent < frame.size())
+    {
+        int n = send(clientfd, frame.data() + sent, frame.size() - sent, 0);
+        if (-1 == n)
+        {
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+// 从连接上读取n个字节，连接关闭或出错返回false
+static bool recvn(int clientfd, char *buf, size_t n)
+{
+    size_t received = 0;
+    while (received < n)
+    {
+        int len = recv(clientfd, buf + received, n - received, 0);
+        if (-1 == len || 0 == len)
+        {
+            return false;
+        }
+        received += len;
+    }
+    return true;
+}
+
+// 从连接上读取一条完整的消息帧
+bool recvMessage(int clientfd, string &msg)
+{
+    uint32_t len = 0;
+    if (!recvn(clientfd, reinterpret_cast<char *>(&len), MSG_HEADER_LEN))
+    {
+        return false;
+    }
+    len = ntohl(len);
+    if (len > static_cast<uint32_t>(MSG_MAX_RESPONSE_LEN))
+    {
+        cerr << "invalid message length " << len << endl;
+        return false;
+    }
+
+    msg.resize(len);
+    return len == 0 || recvn(clientfd, &msg[0], len);
+}
+
 // 显示当前登录成功用户的基本信息
 void showCurrentUserData()
 {
@@ -445,7 +503,7 @@ void addfriend(int clientfd, string str)
     js["friendid"] = friendid;
     string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMessage(clientfd, buffer);
     if (-1 == len)
     {
         cerr << "send addfriend msg error -> " << buffer << endl;
@@ -473,7 +531,7 @@ void chat(int clientfd, string str)
     js["time"] = getCurrentTime();
     string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMessage(clientfd, buffer);
     if (-1 == len)
     {
         cerr << "send chat msg error -> " << buffer << endl;
@@ -499,7 +557,7 @@ void creategroup(int clientfd, string str)
     js["groupdesc"] = groupdesc;
     string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMessage(clientfd, buffer);
     if (-1 == len)
     {
         cerr << "send creategroup msg error -> " << buffer << endl;
@@ -515,7 +573,7 @@ void addgroup(int clientfd, string str)
     js["groupid"] = groupid;
     string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMessage(clientfd, buffer);
     if (-1 == len)
     {
         cerr << "send addgroup msg error -> " << buffer << endl;
@@ -543,7 +601,7 @@ void groupchat(int clientfd, string str)
     js["time"] = getCurrentTime();
     string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMessage(clientfd, buffer);
     if (-1 == len)
     {
         cerr << "send groupchat msg error -> " << buffer << endl;
@@ -557,7 +615,7 @@ void loginout(int clientfd, string)
     js["id"] = g_currentUser.getId();
     string buffer = js.dump();
 
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMessage(clientfd, buffer);
     if (-1 == len)
     {
         cerr << "send loginout msg error -> " << buffer << endl;
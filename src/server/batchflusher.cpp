@@ -0,0 +1,64 @@
+#include "batchflusher.hpp"
+#include "connectionpool.hpp"
+
+BatchFlusher::BatchFlusher(int intervalMs, FlushFunc flush)
+    : intervalMs_(intervalMs), flush_(std::move(flush)), stop_(false),
+      wakeup_(false) {
+    // 保证连接池先于写入器构造，程序退出时析构写入器还能写入剩余的数据
+    ConnectionPool::instance();
+    thread_ = std::thread(&BatchFlusher::flushThread, this);
+}
+
+BatchFlusher::~BatchFlusher() { stop(); }
+
+void BatchFlusher::added(bool full) {
+    bool stopped = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped = stop_;
+        wakeup_ = wakeup_ || full;
+    }
+    if (stopped) {
+        // 后台线程已经停止，直接写入，不能留在缓冲区中
+        flush();
+    } else if (full) {
+        cv_.notify_one();
+    }
+}
+
+bool BatchFlusher::flush() {
+    std::lock_guard<std::mutex> flushLock(flushMutex_);
+    return flush_();
+}
+
+void BatchFlusher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_) {
+            return;
+        }
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+
+    // 后台线程退出后，写入最后一批数据
+    flush();
+}
+
+void BatchFlusher::flushThread() {
+    bool ok = true;
+    for (;;) {
+        {
+            // 上次写入失败时等满一个时间窗口再重试，不因为缓冲区已满而连续重试
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, std::chrono::milliseconds(intervalMs_),
+                         [this, ok]() { return stop_ || (ok && wakeup_); });
+            if (stop_) {
+                return;
+            }
+            wakeup_ = false;
+        }
+        ok = flush();
+    }
+}
@@ -1,47 +1,125 @@
 #include "chatserver.hpp"
 #include "chatservice.hpp"
+#include "chatsession.hpp"
+#include "loopinbox.hpp"
 #include "json.hpp"
 
+#include <algorithm>
 #include <functional>
+#include <muduo/base/Logging.h>
 #include <string>
 
 using json = nlohmann::json;
 
+// 业务线程数量
+static const int kWorkerThreadNum = 8;
+// 输出消息处理次数统计的间隔(秒)
+static const double kStatsInterval = 60.0;
+// 加入集群失败后的重试间隔(秒)，从最小值开始每次失败翻倍，直到最大值
+static const double kMinJoinRetryDelay = 0.5;
+static const double kMaxJoinRetryDelay = 5.0;
+
 ChatServer::ChatServer(EventLoop *loop, const InetAddress &listenAddr,
-                       const string &nameArg)
-    : server_(loop, listenAddr, nameArg), loop_(loop) {
+                       const string &nameArg, const string &nodeid)
+    : loop_(loop),
+      codec_(std::bind(&ChatServer::onMessage, this, std::placeholders::_1,
+                       std::placeholders::_2, std::placeholders::_3)),
+      workerPool_(kWorkerThreadNum), server_(loop, listenAddr, nameArg),
+      leaseThread_(EventLoopThread::ThreadInitCallback(), "LeaseLoop"),
+      nodeid_(nodeid),
+      joinRetryDelay_(kMinJoinRetryDelay) {
     // 注册连接回调
     server_.setConnectionCallback(
         std::bind(&ChatServer::onConnection, this, std::placeholders::_1));
 
-    // 注册消息回调
+    // 注册消息回调，由编解码器拆出完整的消息帧
     server_.setMessageCallback(
-        std::bind(&ChatServer::onMessage, this, std::placeholders::_1,
+        std::bind(&JsonCodec::onMessage, &codec_, std::placeholders::_1,
                   std::placeholders::_2, std::placeholders::_3));
 
+    // 每个IO线程创建自己的投递队列，其它线程发给该线程上连接的消息批量投递
+    server_.setThreadInitCallback(
+        [](EventLoop *ioLoop) { LoopInbox::create(ioLoop); });
+
     server_.setThreadNum(3);
 }
 
-void ChatServer::start() { server_.start(); }
+ChatServer::~ChatServer() {
+    // IO线程还在运行，执行完已经投递的业务，业务中发出的消息仍然可以由IO线程写出
+    // 之后IO线程投递的业务只进入队列，不再执行；server_析构时关闭所有连接并停止IO线程
+    workerPool_.stop();
+}
+
+void ChatServer::start() {
+    ChatService::instance()->init(nodeid_);
+    joinCluster();
+}
+
+void ChatServer::joinCluster() {
+    // 没有加入集群时不接受连接，登录无法在在线用户目录中登记
+    if (!ChatService::instance()->joinCluster()) {
+        LOG_ERROR << "node " << nodeid_ << " join cluster failed, retry after "
+                  << joinRetryDelay_ << "s";
+        loop_->runAfter(joinRetryDelay_, std::bind(&ChatServer::joinCluster, this));
+        joinRetryDelay_ = std::min(joinRetryDelay_ * 2, kMaxJoinRetryDelay);
+        return;
+    }
+    LOG_INFO << "node " << nodeid_ << " joined cluster";
+
+    workerPool_.start();
+    server_.start();
+
+    // 定时续约节点租约，续约会访问redis，在专用线程中执行
+    // 放在业务线程中时，排在前面的慢业务可能让续约超过租约有效期，其它节点会清理本节点仍在线的用户
+    EventLoop *leaseLoop = leaseThread_.startLoop();
+    leaseLoop->runEvery(PresenceDirectory::kLeaseRenewInterval,
+                        []() { ChatService::instance()->keepAlive(); });
+
+    // 定时输出各种消息的累计处理次数
+    loop_->runEvery(kStatsInterval,
+                    []() { ChatService::instance()->logMsgCount(); });
+}
+
+size_t ChatServer::workerKey(const TcpConnectionPtr &conn) const {
+    return std::hash<std::string>()(conn->name());
+}
 
 void ChatServer::onConnection(const TcpConnectionPtr &conn) {
-    // 客户端断开连接
-    if (!conn->connected()) {
+    if (conn->connected()) {
+        // 新连接绑定会话信息，登录、注销和断开时直接读写
+        conn->setContext(ChatSession());
+    } else {
+        // 客户端断开连接
+        // 登录、注销也在IO线程中处理，会话信息只在本线程中读写，直接处理
         ChatService::instance()->clientCloseException(conn);
         conn->shutdown();
     }
 }
 
-void ChatServer::onMessage(const TcpConnectionPtr &conn, Buffer *buffer,
+void ChatServer::onMessage(const TcpConnectionPtr &conn, json &js,
                            Timestamp time) {
-    string buf = buffer->retrieveAllAsString();
-    // 数据的反序列化
-    json js = json::parse(buf);
     // 通过js["msgid"] 获取 => 业务handler => conn js time
     // 达到的目的：完全解耦网络模块的代码和业务模块的代码
 
-    auto msgHandler =
-        ChatService::instance()->getHandler(js["msgid"].get<int>());
-    // 回调消息绑定好的事件处理器，来执行相应的业务处理
-    msgHandler(conn, js, time);
+    // 合法的json不一定带有整数类型的msgid，取值前先检查，类型不符时get会抛出异常
+    json::iterator it = js.find("msgid");
+    if (it == js.end() || !it->is_number_integer()) {
+        LOG_ERROR << conn->name() << " message without integer msgid";
+        return;
+    }
+    int msgid = it->get<int>();
+    // 登录、注销、注册把数据库操作提交给DBExecutor，不阻塞IO线程，直接在IO线程中处理
+    if (ChatService::instance()->handledInLoop(msgid)) {
+        ChatService::instance()->dispatch(msgid, conn, js, time);
+        return;
+    }
+
+    // 其它业务处理会访问MySQL和Redis，交给业务线程执行，不阻塞IO线程
+    // 业务中的conn->send在非IO线程调用时，muduo会通过runInLoop转回连接所属的loop发送
+    workerPool_.run(workerKey(conn),
+                    [conn, msgid, js = std::move(js), time]() mutable {
+                        // 回调消息绑定好的事件处理器，来执行相应的业务处理
+                        ChatService::instance()->dispatch(msgid, conn, js,
+                                                          time);
+                    });
 }
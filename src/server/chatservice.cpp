@@ -1,238 +1,665 @@
 #include "chatservice.hpp"
+#include "chatsession.hpp"
+#include "dbexecutor.hpp"
+#include "jsoncodec.hpp"
 #include "public.hpp"
 
+#include <ctype.h>
+#include <limits.h>
 #include <muduo/base/Logging.h>
+#include <stdlib.h>
+#include <unordered_map>
 #include <vector>
 
 using namespace muduo;
 
+// 获取连接上绑定的会话信息，连接上下文中没有会话信息时返回nullptr
+// 登录、注销和连接断开都在连接所属的IO线程中处理，会话信息只在该线程中读写，不需要加锁
+static ChatSession *getSession(const TcpConnectionPtr &conn) {
+    return boost::any_cast<ChatSession>(conn->getMutableContext());
+}
+
 ChatService *ChatService::instance() {
     static ChatService service;
     return &service;
 }
 
-// 注册消息以及对应的handler回调操作
-ChatService::ChatService() {
-    msgHandlerMap_.insert(
-        {LOGIN_MSG, std::bind(&ChatService::login, this, std::placeholders::_1,
-                              std::placeholders::_2, std::placeholders::_3)});
-    msgHandlerMap_.insert(
-        {LOGINOUT_MSG,
-         std::bind(&ChatService::loginout, this, std::placeholders::_1,
-                   std::placeholders::_2, std::placeholders::_3)});
-    msgHandlerMap_.insert(
-        {REG_MSG, std::bind(&ChatService::reg, this, std::placeholders::_1,
-                            std::placeholders::_2, std::placeholders::_3)});
-
-    msgHandlerMap_.insert(
-        {ONE_CHAT_MSG,
-         std::bind(&ChatService::oneChat, this, std::placeholders::_1,
-                   std::placeholders::_2, std::placeholders::_3)});
-    msgHandlerMap_.insert(
-        {ADD_FRIEND_MSG,
-         std::bind(&ChatService::addFriend, this, std::placeholders::_1,
-                   std::placeholders::_2, std::placeholders::_3)});
-
-    msgHandlerMap_.insert(
-        {CREATE_GROUP_MSG,
-         std::bind(&ChatService::createGroup, this, std::placeholders::_1,
-                   std::placeholders::_2, std::placeholders::_3)});
-    msgHandlerMap_.insert(
-        {ADD_GROUP_MSG,
-         std::bind(&ChatService::addGroup, this, std::placeholders::_1,
-                   std::placeholders::_2, std::placeholders::_3)});
-    msgHandlerMap_.insert(
-        {GROUP_CHAT_MSG,
-         std::bind(&ChatService::groupChat, this, std::placeholders::_1,
-                   std::placeholders::_2, std::placeholders::_3)});
-
-    if (redis_.connect()) {
-        redis_.init_notify_handler(
-            std::bind(&ChatService::handleRedisSubscribeMessage, this,
-                      std::placeholders::_1, std::placeholders::_2));
+// 消息id和其对应的业务处理方法，编译期生成，按msgid下标直接索引
+// inLoop为true的业务处理方法不会阻塞，直接在IO线程中执行，数据库操作交给DBExecutor
+struct MsgHandlerTable {
+    MsgHandler handlers[MAX_MSG_TYPE];
+    bool inLoop[MAX_MSG_TYPE];
+};
+
+static constexpr MsgHandlerTable makeMsgHandlerTable() {
+    MsgHandlerTable table{};
+    table.handlers[LOGIN_MSG] = &ChatService::login;
+    table.handlers[LOGINOUT_MSG] = &ChatService::loginout;
+    table.handlers[REG_MSG] = &ChatService::reg;
+    table.handlers[ONE_CHAT_MSG] = &ChatService::oneChat;
+    table.handlers[ADD_FRIEND_MSG] = &ChatService::addFriend;
+    table.handlers[CREATE_GROUP_MSG] = &ChatService::createGroup;
+    table.handlers[ADD_GROUP_MSG] = &ChatService::addGroup;
+    table.handlers[GROUP_CHAT_MSG] = &ChatService::groupChat;
+    table.inLoop[LOGIN_MSG] = true;
+    table.inLoop[LOGINOUT_MSG] = true;
+    table.inLoop[REG_MSG] = true;
+    return table;
+}
+
+static constexpr MsgHandlerTable kMsgHandlerTable = makeMsgHandlerTable();
+
+// 服务器节点订阅的redis通道
+static std::string nodeChannel(const std::string &nodeid) {
+    return "chat:node:" + nodeid;
+}
+
+// 跨服务器消息的信封：以','分隔的接收者userid列表 + '\n' + 原始消息
+// 群消息发给同一个服务器上的多个成员时，消息体只携带一份
+static std::string packEnvelope(const std::vector<int> &useridVec,
+                                const std::string &msg) {
+    std::string envelope;
+    envelope.reserve(useridVec.size() * 8 + msg.size() + 1);
+    for (size_t i = 0; i < useridVec.size(); ++i) {
+        if (i != 0) {
+            envelope += ',';
+        }
+        envelope += std::to_string(useridVec[i]);
+    }
+    envelope += '\n';
+    envelope += msg;
+    return envelope;
+}
+
+// 解析信封中[p, end)之间的接收者userid列表，格式不符时返回false
+// 每个id都是十进制数字，id之间只能是一个','，最后一个id紧跟着'\n'
+static bool parseUserids(const char *p, const char *end,
+                         std::vector<int> &useridVec) {
+    if (p == end) {
+        return false;
+    }
+    for (;;) {
+        if (!isdigit(static_cast<unsigned char>(*p))) {
+            return false;
+        }
+        char *next = nullptr;
+        long userid = strtol(p, &next, 10);
+        if (next > end || userid > INT_MAX) {
+            return false;
+        }
+        useridVec.push_back(static_cast<int>(userid));
+        if (next == end) {
+            return true;
+        }
+        if (*next != ',' || next + 1 == end) {
+            return false;
+        }
+        p = next + 1;
+    }
+}
+
+ChatService::ChatService() : unknownMsgCount_(0), presence_(redis_) {
+    for (auto &count : msgCount_) {
+        count = 0;
+    }
+}
+
+void ChatService::setDeliveryMode(Redis::DeliveryMode mode) {
+    redis_.setDeliveryMode(mode);
+}
+
+void ChatService::init(const std::string &nodeid) {
+    nodeid_ = nodeid;
+    // 观察线程启动后随时可能上报消息，先设置回调
+    redis_.init_notify_handler(
+        std::bind(&ChatService::handleRedisSubscribeMessage, this,
+                  std::placeholders::_1));
+    // redis暂时不可用时，各连接在后台按退避间隔重连
+    if (!redis_.connect()) {
+        LOG_ERROR << "connect redis failed, reconnect in background!";
+    }
+
+    // 每个服务器节点只订阅自己的通道，发给本节点用户的消息都从这个通道收到
+    // 订阅连接还没有建立时，连接成功后自动订阅
+    redis_.subscribe(nodeChannel(nodeid_));
+}
+
+bool ChatService::joinCluster() {
+    // 清理本节点上次运行异常退出时遗留的在线用户，再取得本节点的租约
+    std::vector<std::pair<int, long long>> swept;
+    if (!presence_.join(nodeid_, swept)) {
+        return false;
     }
+    userStateWriter_.update(swept, "offline");
+    return true;
 }
 
 void ChatService::reset() {
-    // 把online状态的用户，设置成offline
-    userModel_.resetState();
+    // 调用前续约线程和所有IO线程都已经停止，不会再有登录，也不会再重新登记本节点的用户
+    // 写入还在缓冲区中的离线消息
+    offlineMsgWriter_.stop();
+
+    // 从在线用户目录中一次删除本服务器的租约和所有用户
+    // 本节点留在节点集合中，STREAM方式下由存活节点在租约过期后清理本节点的Stream
+    // 连接关闭时没有来得及注销的用户还留在连接表中，和目录中删除的用户一起置为offline
+    std::vector<std::pair<int, long long>> sessions = presence_.sweep(nodeid_);
+    userConnectionMap_.forEach(
+        [&sessions](int userid, const TcpConnectionPtr &, long long epoch) {
+            sessions.emplace_back(userid, epoch);
+        });
+
+    // 只把本服务器上的用户设置成offline，不影响其它服务器上的用户
+    userStateWriter_.update(sessions, "offline");
+    userStateWriter_.stop();
 }
 
-MsgHandler ChatService::getHandler(int msgid) {
-    // 记录错误日志，msgid没有对应的事件处理回调
-    auto it = msgHandlerMap_.find(msgid);
-    if (it == msgHandlerMap_.end()) {
-        return [=](auto a, auto b, auto c) {
-            LOG_ERROR << "msgid:" << msgid << "can not find handler!";
-        };
-    } else {
-        return msgHandlerMap_[msgid];
+void ChatService::keepAlive() {
+    // 租约已经过期时，其它节点可能已经清理了本节点的用户，重新登记仍然在线的用户
+    if (!presence_.renewLease(nodeid_)) {
+        // 会话纪元在登录时记录在连接表中，不读取其它线程正在修改的会话信息
+        std::vector<std::pair<int, long long>> sessions;
+        userConnectionMap_.forEach(
+            [&sessions](int userid, const TcpConnectionPtr &, long long epoch) {
+                sessions.emplace_back(userid, epoch);
+            });
+        presence_.restore(nodeid_, sessions);
+
+        // 取快照之后注销的用户可能已经撤销了登记，又被上面重新登记，会一直无法登录
+        // 注销时先从连接表中删除再撤销登记，这里重新登记之后再检查连接表，撤销已经不在表中的会话
+        // 其它节点清理时可能已经把这些用户在mysql中置为offline，纪元相同，重新置为online
+        // 检查连接表之前写入，已经注销的会话随后再写入offline，保证最后写入的是offline
+        userStateWriter_.update(sessions, "online");
+        for (const auto &session : sessions) {
+            if (!userConnectionMap_.contains(session.first, session.second)) {
+                presence_.release(session.first, nodeid_, session.second);
+                userStateWriter_.update(session.first, session.second,
+                                        "offline");
+            }
+        }
+    }
+
+    // 异常退出的节点不再续约，租约过期后由存活的节点把其上的用户批量置为离线
+    std::vector<std::string> expiredNodes;
+    std::vector<std::pair<int, long long>> swept =
+        presence_.sweepExpired(expiredNodes);
+    if (!swept.empty()) {
+        LOG_INFO << "sweep " << swept.size() << " users of expired nodes";
+        userStateWriter_.update(swept, "offline");
+    }
+    // STREAM方式下过期节点的Stream不会再有人读取，其中没有处理完的消息转为离线消息后删除Stream
+    // 节点id带有进程id时，节点每次重启都会留下一个这样的Stream
+    for (const std::string &node : expiredNodes) {
+        if (node != nodeid_) {
+            LOG_INFO << "drain stream of expired node " << node;
+            redis_.drainStream(nodeChannel(node));
+        }
     }
 }
 
+void ChatService::dispatch(int msgid, const TcpConnectionPtr &conn, json &js,
+                           Timestamp time) {
+    if (msgid <= 0 || msgid >= MAX_MSG_TYPE ||
+        kMsgHandlerTable.handlers[msgid] == nullptr) {
+        // 记录错误日志，msgid没有对应的事件处理回调
+        unknownMsgCount_.fetch_add(1, std::memory_order_relaxed);
+        LOG_ERROR << "msgid:" << msgid << " can not find handler!";
+        return;
+    }
+
+    msgCount_[msgid].fetch_add(1, std::memory_order_relaxed);
+    try {
+        (this->*kMsgHandlerTable.handlers[msgid])(conn, js, time);
+    } catch (const json::exception &e) {
+        // 消息缺少字段或者字段类型不符，只丢弃这条消息，异常不能结束IO线程或业务线程
+        LOG_ERROR << "msgid:" << msgid << " invalid message: " << e.what();
+    }
+}
+
+bool ChatService::handledInLoop(int msgid) const {
+    return msgid > 0 && msgid < MAX_MSG_TYPE && kMsgHandlerTable.inLoop[msgid];
+}
+
+uint64_t ChatService::getMsgCount(int msgid) const {
+    if (msgid <= 0 || msgid >= MAX_MSG_TYPE) {
+        return unknownMsgCount_.load(std::memory_order_relaxed);
+    }
+    return msgCount_[msgid].load(std::memory_order_relaxed);
+}
+
+void ChatService::logMsgCount() const {
+    // 格式：msgid:次数，最后是没有处理器的消息数
+    std::string stats;
+    for (int msgid = 1; msgid < MAX_MSG_TYPE; ++msgid) {
+        if (kMsgHandlerTable.handlers[msgid] != nullptr) {
+            stats += std::to_string(msgid) + ":" +
+                     std::to_string(getMsgCount(msgid)) + " ";
+        }
+    }
+    stats += "unknown:" + std::to_string(getMsgCount(0));
+    LOG_INFO << "message count " << stats;
+}
+
+// 登录、注册请求在数据库线程中等待执行的期限(ms)，超过期限直接返回服务器繁忙
+static const int kLoginTimeoutMs = 3000;
+// 登录响应发出后，再次拉取离线消息的延迟(秒)
+// 大于离线消息写入器的缓冲时间窗口和在线用户目录缓存不在线结果的时间
+static const double kLateOfflineFetchDelay = 0.5;
+// 登录响应中携带的离线消息的总长度上限，积压很多离线消息时登录响应不会超过客户端的帧长度限制
+static const size_t kMaxAckMsgBytes = MSG_MAX_LEN;
+
+static void sendLoginError(const TcpConnectionPtr &conn, int err,
+                           const std::string &errmsg) {
+    json response;
+    response["msgid"] = LOGIN_MSG_ACK;
+    response["errno"] = err;
+    response["errmsg"] = errmsg;
+    JsonCodec::send(conn, response.dump());
+}
+
+// 在IO线程中执行，数据库操作都提交给数据库线程，完成后回到IO线程继续
 void ChatService::login(const TcpConnectionPtr &conn, json &js,
                         Timestamp time) {
     int id = js["id"].get<int>();
     std::string pwd = js["password"];
-    User user = userModel_.query(id);
-    if (user.getId() == id && user.getPassword() == pwd) {
-        if (user.getState() == "online") {
-            // 该用户已经登录，不允许重复登录
-            json response;
-            response["msgid"] = LOGIN_MSG_ACK;
-            response["errno"] = 2;
-            response["errmsg"] = "this account is using, input another";
-            conn->send(response.dump());
-        } else {
-            // 登录成功
 
-            // 记录用户连接信息
-            {
-                std::lock_guard<std::mutex> lock(connMutex_);
-                userConnectionMap_.insert({id, conn});
+    ChatSession *session = getSession(conn);
+    if (session == nullptr) {
+        return;
+    }
+    if (session->state == ChatSession::LOGINING ||
+        session->state == ChatSession::LOGIN) {
+        // 同一个连接上重复登录，会覆盖之前登录的用户，使其连接信息和在线登记无法清理
+        sendLoginError(conn, 2, "this connection has already logged in");
+        return;
+    }
+    session->state = ChatSession::LOGINING;
+    session->epoch = 0;
+    session->loginoutPending = false;
+
+    // 第一步：校验密码，在集群在线用户目录中登记
+    // 判断和登记是原子的，同一用户同时在多个节点登录时只有一个成功
+    struct LoginAuth {
+        User user;
+        long long epoch = -1;
+    };
+    std::shared_ptr<LoginAuth> auth = std::make_shared<LoginAuth>();
+    DBRequestPtr request = DBExecutor::instance()->submit(
+        conn->getLoop(),
+        [this, id, pwd, auth]() {
+            auth->user = userModel_.query(id);
+            if (auth->user.getId() == id && auth->user.getPassword() == pwd) {
+                auth->epoch = presence_.claim(id, nodeid_);
+            } else {
+                auth->user = User();
+            }
+        },
+        [this, conn, auth](bool ok) {
+            ChatSession *session = getSession(conn);
+            session->request.reset();
+            if (!conn->connected()) {
+                // 等待数据库期间连接已经断开，撤销在线用户目录中的登记
+                // 撤销登记只访问redis，MySQL不可用时也要执行，否则该用户在任何节点都无法再登录
+                if (auth->epoch > 0) {
+                    int id = auth->user.getId();
+                    long long epoch = auth->epoch;
+                    DBExecutor::instance()->submit(
+                        conn->getLoop(),
+                        [this, id, epoch]() {
+                            presence_.release(id, nodeid_, epoch);
+                        },
+                        nullptr, 0, DBExecutor::kNoConnection);
+                }
+                return;
+            }
+            if (ok && auth->epoch > 0) {
+                loginAuthed(conn, auth->user, auth->epoch);
+                return;
             }
 
-            // id用户登录成功后，向redis订阅channel(id)
-            redis_.subscribe(id);
+            // 登录失败，连接回到未登录状态，登录过程中收到的注销请求不再需要处理
+            session->state = ChatSession::CONNECTED;
+            session->loginoutPending = false;
+            if (!ok) {
+                sendLoginError(conn, 3, "server is busy, try again later");
+            } else if (auth->user.getId() == -1) {
+                // 该用户不存在，登录失败
+                // 用户存在但是密码错误
+                sendLoginError(conn, 1, "id or password is invalid!");
+            } else if (auth->epoch == 0) {
+                // 该用户已经登录，不允许重复登录
+                sendLoginError(conn, 2, "this account is using, input another");
+            } else {
+                // 在线用户目录不可用，无法保证不重复登录
+                sendLoginError(conn, 3, "server is busy, try again later");
+            }
+        },
+        kLoginTimeoutMs);
 
-            // 更新用户状态信息 state offline->online
-            user.setState("online");
-            userModel_.updateState(user);
+    // 连接断开时取消还没有执行的登录请求
+    session->request = request;
+}
 
-            json response;
-            response["msgid"] = LOGIN_MSG_ACK;
-            response["errno"] = 0;
-            response["id"] = user.getId();
-            response["name"] = user.getName();
-            // 查询该用户是否有离线消息
-            std::vector<std::string> vec = offlineMsgModel_.query(id);
-            if (!vec.empty()) {
-                response["offlinemsg"] = vec;
-                // 读取后，把该用户的所有离线消息删除
-                offlineMsgModel_.remove(id);
+void ChatService::loginAuthed(const TcpConnectionPtr &conn, const User &user,
+                              long long epoch) {
+    int id = user.getId();
+
+    // 登录校验通过，会话仍然处于登录中，登录响应发出后才进入已登录状态
+    // 在此期间连接断开或收到注销请求时，按会话中记录的纪元撤销在线用户目录中的登记
+    // 用户连接在发出登录响应时才记录，在此之前发给该用户的消息存为离线消息
+    ChatSession *session = getSession(conn);
+    session->userid = id;
+    session->epoch = epoch;
+
+    // 第二步：离线消息、群消息、好友列表、群组列表互不依赖，分别提交给数据库线程并发查询
+    // 各请求的完成回调都在本IO线程中执行，全部完成后组装登录响应，不需要加锁
+    // 离线消息的删除和群消息读游标的移动等登录响应发出后再执行，登录中途断开时消息仍然留在数据库中
+    struct LoginAssembly {
+        int pending = 4;
+        std::vector<std::string> offlineMsgs;
+        // 读到的最大离线消息序号
+        long long offlineMaxId = 0;
+        std::vector<std::string> groupMsgs;
+        // 各群组读到的最大群消息序号，groupid -> msgid
+        std::unordered_map<int, long long> groupCursors;
+        std::vector<std::string> friends;
+        std::vector<std::string> groups;
+    };
+    std::shared_ptr<LoginAssembly> assembly = std::make_shared<LoginAssembly>();
+    std::string name = user.getName();
+    DBExecutor::Callback join = [this, conn, id, name, assembly](bool) {
+        if (--assembly->pending > 0) {
+            return;
+        }
+        // 查询期间连接已经断开，断开时已经撤销了登录，读到的消息没有删除，下次登录时再读取
+        ChatSession *session = getSession(conn);
+        if (session->state != ChatSession::LOGINING) {
+            return;
+        }
+
+        json response;
+        response["msgid"] = LOGIN_MSG_ACK;
+        response["errno"] = 0;
+        response["id"] = id;
+        response["name"] = name;
+        // 没有执行成功的查询结果为空，对应的离线消息留在数据库中，下次登录时再读取
+        std::vector<std::string> &vec = assembly->offlineMsgs;
+        vec.insert(vec.end(), assembly->groupMsgs.begin(),
+                   assembly->groupMsgs.end());
+        // 登录响应中只携带不超过kMaxAckMsgBytes的离线消息，其余的在登录响应之后逐条发送
+        size_t ackMsgNum = 0;
+        size_t ackMsgBytes = 0;
+        while (ackMsgNum < vec.size() &&
+               ackMsgBytes + vec[ackMsgNum].size() <= kMaxAckMsgBytes) {
+            ackMsgBytes += vec[ackMsgNum].size();
+            ++ackMsgNum;
+        }
+        if (ackMsgNum > 0) {
+            response["offlinemsg"] = std::vector<std::string>(
+                vec.begin(), vec.begin() + ackMsgNum);
+        }
+        if (!assembly->friends.empty()) {
+            response["friends"] = assembly->friends;
+        }
+        if (!assembly->groups.empty()) {
+            response["groups"] = assembly->groups;
+        }
+        // 记录用户连接和发送登录响应在IO线程的同一次回调中完成
+        // 其它线程发给该连接的消息经由本IO线程转发，一定排在登录响应之后
+        userConnectionMap_.insert(id, conn, session->epoch);
+        JsonCodec::send(conn, response.dump());
+        for (size_t i = ackMsgNum; i < vec.size(); ++i) {
+            JsonCodec::send(conn, vec[i]);
+        }
+
+        // 消息已经发出，删除读到的离线消息，把读游标移动到读到的群消息
+        // 只删除不超过读到的最大序号的离线消息，查询之后其它节点写入的离线消息留给下次读取
+        long long offlineMaxId = assembly->offlineMaxId;
+        std::unordered_map<int, long long> groupCursors =
+            std::move(assembly->groupCursors);
+        if (offlineMaxId > 0 || !groupCursors.empty()) {
+            DBExecutor::instance()->submit(
+                conn->getLoop(),
+                [this, id, offlineMaxId, groupCursors]() {
+                    if (offlineMaxId > 0) {
+                        offlineMsgModel_.remove(id, offlineMaxId);
+                    }
+                    if (!groupCursors.empty()) {
+                        groupMsgModel_.updateCursor(id, groupCursors);
+                        groupMsgModel_.prune(id);
+                    }
+                },
+                nullptr);
+        }
+
+        // 登录完成，处理登录过程中收到的注销请求
+        session->state = ChatSession::LOGIN;
+        if (session->loginoutPending) {
+            logout(conn, session);
+            return;
+        }
+        fetchLateOfflineMsgs(conn, id);
+    };
+
+    // mysql中的state只作为好友列表展示用的镜像，不再用于判断是否在线，合并后批量写入
+    // 带上会话纪元，之前在其它节点上的登录晚到的offline不会覆盖这次登录
+    userStateWriter_.update(id, epoch, "online");
+
+    DBExecutor *executor = DBExecutor::instance();
+    executor->submit(
+        conn->getLoop(),
+        [this, id, assembly]() {
+            // 查询该用户是否有离线消息，先写入还在缓冲区中的离线消息
+            offlineMsgWriter_.flush();
+            assembly->offlineMsgs =
+                offlineMsgModel_.query(id, assembly->offlineMaxId);
+        },
+        join);
+    executor->submit(
+        conn->getLoop(),
+        [this, id, assembly]() {
+            // 拉取各群组读游标之后的群消息，读游标只移动到实际读到的消息
+            assembly->groupMsgs =
+                groupMsgModel_.query(id, assembly->groupCursors);
+        },
+        join);
+    executor->submit(
+        conn->getLoop(),
+        [this, id, assembly]() {
+            // 查询该用户的好友信息
+            for (User &user : friendModel_.query(id)) {
+                json js;
+                js["id"] = user.getId();
+                js["name"] = user.getName();
+                // 还没有写入mysql的状态优先
+                js["state"] = userStateWriter_.state(user.getId(),
+                                                     user.getState());
+                assembly->friends.push_back(js.dump());
             }
-            // 查询该用户的好友信息并返回
-            std::vector<User> userVec = friendModel_.query(id);
-            if (!userVec.empty()) {
-                std::vector<std::string> user2jsVec;
-                for (User &user : userVec) {
+        },
+        join);
+    executor->submit(
+        conn->getLoop(),
+        [this, id, assembly]() {
+            // 查询该用户的群组信息
+            for (Group &group : groupModel_.queryGroups(id)) {
+                json grpjs;
+                grpjs["id"] = group.getId();
+                grpjs["groupname"] = group.getName();
+                grpjs["groupdesc"] = group.getDesc();
+                std::vector<std::string> userV;
+                for (GroupUser &user : group.getUsers()) {
                     json js;
                     js["id"] = user.getId();
                     js["name"] = user.getName();
-                    js["state"] = user.getState();
-                    user2jsVec.push_back(js.dump());
+                    js["state"] = userStateWriter_.state(user.getId(),
+                                                         user.getState());
+                    js["role"] = user.getRole();
+                    userV.push_back(js.dump());
                 }
-                response["friends"] = user2jsVec;
+                grpjs["users"] = userV;
+                assembly->groups.push_back(grpjs.dump());
             }
+        },
+        join);
+}
 
-            conn->send(response.dump());
+void ChatService::fetchLateOfflineMsgs(const TcpConnectionPtr &conn,
+                                       int userid) {
+    // 等其它节点的离线消息写入器写完登录期间缓冲的消息再读取
+    conn->getLoop()->runAfter(kLateOfflineFetchDelay, [this, conn, userid]() {
+        ChatSession *session = getSession(conn);
+        if (!conn->connected() || session->state != ChatSession::LOGIN) {
+            return;
         }
 
-    } else {
-        // 该用户不存在，登录失败
-        // 用户存在但是密码错误
-        json response;
-        response["msgid"] = LOGIN_MSG_ACK;
-        response["errno"] = 1;
-        response["errmsg"] = "id or password is invalid!";
-        conn->send(response.dump());
-    }
+        struct LateOfflineMsgs {
+            std::vector<std::string> msgs;
+            long long maxid = 0;
+        };
+        std::shared_ptr<LateOfflineMsgs> late =
+            std::make_shared<LateOfflineMsgs>();
+        DBExecutor::instance()->submit(
+            conn->getLoop(),
+            [this, userid, late]() {
+                offlineMsgWriter_.flush();
+                late->msgs = offlineMsgModel_.query(userid, late->maxid);
+            },
+            [this, conn, userid, late](bool) {
+                // 查询期间已经注销或断开连接时不删除，消息留给下次登录读取
+                ChatSession *session = getSession(conn);
+                if (late->msgs.empty() || !conn->connected() ||
+                    session->state != ChatSession::LOGIN) {
+                    return;
+                }
+                for (const std::string &msg : late->msgs) {
+                    JsonCodec::send(conn, msg);
+                }
+                long long maxid = late->maxid;
+                DBExecutor::instance()->submit(
+                    conn->getLoop(),
+                    [this, userid, maxid]() {
+                        offlineMsgModel_.remove(userid, maxid);
+                    },
+                    nullptr);
+            });
+    });
 }
 
+// 在IO线程中执行，插入操作提交给数据库线程
 void ChatService::reg(const TcpConnectionPtr &conn, json &js, Timestamp time) {
-    std::string name = js["name"];
-    std::string pwd = js["password"];
-
-    User user;
-    user.setName(name);
-    user.setPassword(pwd);
-    bool state = userModel_.insert(user);
-    if (state) {
-        // 注册成功
-        json response;
-        response["msgid"] = REG_MSG_ACK;
-        response["errno"] = 0;
-        response["id"] = user.getId();
-        conn->send(response.dump());
-    } else {
-        // 注册失败
-        json response;
-        response["msgid"] = REG_MSG_ACK;
-        response["errno"] = 1;
-        conn->send(response.dump());
-    }
+    std::shared_ptr<User> user = std::make_shared<User>();
+    user->setName(js["name"].get<std::string>());
+    user->setPassword(js["password"].get<std::string>());
+
+    std::shared_ptr<bool> state = std::make_shared<bool>(false);
+    DBExecutor::instance()->submit(
+        conn->getLoop(),
+        [this, user, state]() { *state = userModel_.insert(*user); },
+        [conn, user, state](bool ok) {
+            json response;
+            response["msgid"] = REG_MSG_ACK;
+            if (ok && *state) {
+                // 注册成功
+                response["errno"] = 0;
+                response["id"] = user->getId();
+            } else {
+                // 注册失败
+                response["errno"] = 1;
+            }
+            JsonCodec::send(conn, response.dump());
+        },
+        kLoginTimeoutMs);
 }
 
+// 在IO线程中执行，在线用户目录和数据库的操作提交给数据库线程
 void ChatService::loginout(const TcpConnectionPtr &conn, json &js,
                            Timestamp time) {
-    int userid = js["id"].get<int>();
+    // 只能注销本连接上登录的用户，不信任消息中携带的id
+    ChatSession *session = getSession(conn);
+    if (session == nullptr) {
+        return;
+    }
+    if (session->state == ChatSession::LOGINING) {
+        // 登录还没有完成，登录响应发出后再注销，保证客户端看到的顺序和请求的顺序一致
+        session->loginoutPending = true;
+        return;
+    }
+    if (session->state == ChatSession::LOGIN) {
+        logout(conn, session);
+    }
+}
 
-    {
-        std::lock_guard<std::mutex> lock(connMutex_);
-        auto it = userConnectionMap_.find(userid);
-        if (it != userConnectionMap_.end()) {
-            userConnectionMap_.erase(it);
-        }
+// 在IO线程中执行，连接断开的回调和登录、注销的处理不会交错
+void ChatService::clientCloseException(const TcpConnectionPtr &conn) {
+    ChatSession *session = getSession(conn);
+    if (session == nullptr) {
+        return;
     }
 
-    // 用户注销，在redis中取消订阅通道
-    redis_.unsubscribe(userid);
+    // 取消还没有执行的登录请求，已经开始执行的请求完成时发现连接断开，会撤销在线登记
+    if (session->request) {
+        session->request->cancel();
+        session->request.reset();
+    }
 
-    // 更新用户的状态信息
-    User user(userid, "", "", "offline");
-    userModel_.updateState(user);
+    // 已登录，或者登录校验已经通过、正在查询登录数据的连接，撤销本次登录
+    if (session->state == ChatSession::LOGIN ||
+        (session->state == ChatSession::LOGINING && session->epoch > 0)) {
+        logout(conn, session);
+    }
+    session->state = ChatSession::LOGINOUT;
 }
 
-void ChatService::clientCloseException(const TcpConnectionPtr &conn) {
-    User user;
-    {
-        std::lock_guard<std::mutex> lock(connMutex_);
-
-        for (auto it = userConnectionMap_.begin();
-             it != userConnectionMap_.end(); it++) {
-            if (it->second == conn) {
-                // 从map中删除用户的连接信息
-                user.setId(it->first);
-                userConnectionMap_.erase(it);
-                break;
-            }
-        }
-    }
+void ChatService::logout(const TcpConnectionPtr &conn, ChatSession *session) {
+    int userid = session->userid;
+    long long epoch = session->epoch;
+    // 登录响应已经发出时，在线期间的群消息已经实时收到，需要移动群消息读游标
+    bool online = session->state == ChatSession::LOGIN;
+    session->state = ChatSession::LOGINOUT;
+    session->loginoutPending = false;
 
-    // 用户注销，在redis中取消订阅通道
-    redis_.unsubscribe(user.getId());
+    // 从map中删除用户的连接信息
+    userConnectionMap_.erase(userid, conn);
 
     // 更新用户的状态信息
-    if (user.getId() != -1) {
-        user.setState("offline");
-        userModel_.updateState(user);
-    }
+    userStateWriter_.update(userid, epoch, "offline");
+
+    // 用户注销，移动群消息读游标，删除所有成员都已读过的群消息，再从在线用户目录中删除本次登录
+    // 先撤销登记时，期间的群消息会把该用户当作离线存入groupmessage，读游标随后越过它，用户再也收不到
+    // 撤销登记不依赖MySQL，不绑定连接执行，只有游标的移动在MySQL不可用时失败
+    DBExecutor::instance()->submit(
+        conn->getLoop(),
+        [this, userid, epoch, online]() {
+            if (online) {
+                groupMsgModel_.updateCursor(userid);
+                groupMsgModel_.prune(userid);
+            }
+            presence_.release(userid, nodeid_, epoch);
+        },
+        nullptr, 0, DBExecutor::kNoConnection);
 }
 
 void ChatService::oneChat(const TcpConnectionPtr &conn, json &js,
                           Timestamp time) {
     int toid = js["to"].get<int>();
 
-    {
-        std::lock_guard<std::mutex> lock(connMutex_);
-        auto it = userConnectionMap_.find(toid);
-        if (it != userConnectionMap_.end()) {
-            // 对方在线，转发消息
-            // 服务器主动推送消息给对方
-            it->second->send(js.dump());
-            return;
-        }
+    TcpConnectionPtr toConn = userConnectionMap_.find(toid);
+    if (toConn) {
+        // 对方在线，转发消息
+        // 服务器主动推送消息给对方
+        JsonCodec::send(toConn, js.dump());
+        return;
     }
 
-    // 查询toid是否在线
-    User user = userModel_.query(toid);
-    if (user.getState() == "online") {
-        redis_.publish(toid, js.dump());
+    // 查询在线用户目录，对方在其它服务器上在线时发布到对方所在服务器的通道
+    std::string node = presence_.lookup(toid);
+    if (!node.empty()) {
+        redis_.publish(nodeChannel(node), packEnvelope({toid}, js.dump()));
         return;
     }
 
     // 对方不在线，存储离线消息
-    offlineMsgModel_.insert(toid, js.dump());
+    offlineMsgWriter_.append(toid, js.dump());
 }
 
 void ChatService::addFriend(const TcpConnectionPtr &conn, json &js,
@@ -255,6 +682,7 @@ void ChatService::createGroup(const TcpConnectionPtr &conn, json &js,
     if (groupModel_.createGroup(group)) {
         // 存储群组创建人信息
         groupModel_.addGroup(userid, group.getId(), "creator");
+        groupMsgModel_.updateCursor(userid, group.getId());
     }
 }
 
@@ -264,6 +692,8 @@ void ChatService::addGroup(const TcpConnectionPtr &conn, json &js,
     int userid = js["id"].get<int>();
     int groupid = js["groupid"].get<int>();
     groupModel_.addGroup(userid, groupid, "normal");
+    // 新成员只接收加入之后的群消息
+    groupMsgModel_.updateCursor(userid, groupid);
 }
 
 // 群组聊天业务
@@ -273,34 +703,74 @@ void ChatService::groupChat(const TcpConnectionPtr &conn, json &js,
     int groupid = js["groupid"].get<int>();
     std::vector<int> useridVec = groupModel_.queryGroupUsers(userid, groupid);
 
-    std::lock_guard<std::mutex> lock(connMutex_);
+    // 群消息只序列化一次，本地转发、redis发布和离线存储都使用同一份数据
+    const std::string msg = js.dump();
+
+    // 先把群成员分成 本服务器在线、其它服务器在线、离线 三类，再统一发送
+    std::vector<TcpConnectionPtr> localConnVec;
+    std::vector<int> absentVec;
     for (int id : useridVec) {
-        auto it = userConnectionMap_.find(id);
-        if (it != userConnectionMap_.end()) {
-            // 转发群消息
-            it->second->send(js.dump());
+        TcpConnectionPtr memberConn = userConnectionMap_.find(id);
+        if (memberConn) {
+            localConnVec.push_back(memberConn);
         } else {
-            // 存储离线群消息    // 查询toid是否在线
-            User user = userModel_.query(id);
-            if (user.getState() == "online") {
-                redis_.publish(id, js.dump());
-            } else {
-                offlineMsgModel_.insert(id, js.dump());
-            }
+            absentVec.push_back(id);
         }
     }
-}
 
-void ChatService::handleRedisSubscribeMessage(int userid, std::string msg) {
-    json js = json::parse(msg.c_str());
+    // 转发群消息
+    if (!localConnVec.empty()) {
+        std::shared_ptr<const std::string> frame = JsonCodec::encode(msg);
+        for (const TcpConnectionPtr &memberConn : localConnVec) {
+            JsonCodec::sendFrame(memberConn, frame);
+        }
+    }
+    // 不在本服务器的成员一次查询在线用户目录，在线的按所在服务器分组，每个服务器只发布一次
+    std::vector<std::string> nodeVec = presence_.lookup(absentVec);
+    std::unordered_map<std::string, std::vector<int>> nodeMembers;
+    std::vector<int> offlineVec;
+    for (size_t i = 0; i < absentVec.size(); ++i) {
+        if (nodeVec[i].empty()) {
+            offlineVec.push_back(absentVec[i]);
+        } else {
+            nodeMembers[nodeVec[i]].push_back(absentVec[i]);
+        }
+    }
+    for (const auto &entry : nodeMembers) {
+        redis_.publish(nodeChannel(entry.first),
+                       packEnvelope(entry.second, msg));
+    }
+    // 有离线成员时，群消息只存储一份，离线成员登录时按读游标拉取
+    if (!offlineVec.empty()) {
+        groupMsgModel_.insert(groupid, msg);
+    }
+}
 
-    std::lock_guard<std::mutex> lock(connMutex_);
-    auto it = userConnectionMap_.find(userid);
-    if (it != userConnectionMap_.end()) {
-        it->second->send(js.dump());
+void ChatService::handleRedisSubscribeMessage(const std::string &envelope) {
+    // 拆开信封，得到接收者userid列表和原始消息
+    size_t pos = envelope.find('\n');
+    if (pos == std::string::npos) {
+        LOG_ERROR << "invalid redis message:" << envelope;
+        return;
+    }
+    std::vector<int> useridVec;
+    if (!parseUserids(envelope.c_str(), envelope.c_str() + pos, useridVec)) {
+        LOG_ERROR << "invalid redis message:" << envelope;
         return;
     }
 
-    // 存储该用户的离线消息
-    offlineMsgModel_.insert(userid, msg);
+    // 消息体是发送方序列化好的json，原样转发，不再反序列化
+    // 同一条消息发给本服务器上的多个用户时，只编码一次
+    const char *msg = envelope.data() + pos + 1;
+    size_t msgLen = envelope.size() - pos - 1;
+    std::shared_ptr<const std::string> frame = JsonCodec::encode(msg, msgLen);
+    for (int userid : useridVec) {
+        TcpConnectionPtr conn = userConnectionMap_.find(userid);
+        if (conn) {
+            JsonCodec::sendFrame(conn, frame);
+        } else {
+            // 存储该用户的离线消息
+            offlineMsgWriter_.append(userid, std::string(msg, msgLen));
+        }
+    }
 }
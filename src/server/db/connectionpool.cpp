@@ -0,0 +1,160 @@
+#include "connectionpool.hpp"
+
+#include <muduo/base/Logging.h>
+
+// 连接池配置信息
+static const int kInitSize = 4;
+static const int kMaxSize = 64;
+static const int kMaxIdleTime = 60 * 1000;
+static const int kConnectionTimeout = 1000;
+static const int kPingIdleTime = 30 * 1000;
+
+// 当前线程绑定的连接
+static thread_local std::shared_ptr<MySQL> t_threadConnection;
+
+ConnectionPool *ConnectionPool::instance() {
+    static ConnectionPool pool;
+    return &pool;
+}
+
+ConnectionPool::ConnectionPool()
+    : _initSize(kInitSize), _maxSize(kMaxSize), _maxIdleTime(kMaxIdleTime),
+      _connectionTimeout(kConnectionTimeout), _pingIdleTime(kPingIdleTime),
+      _connCnt(0), _stop(false) {
+    // 预先创建初始数量的连接
+    for (int i = 0; i < _initSize; ++i) {
+        MySQL *conn = createConnection();
+        if (conn == nullptr) {
+            break;
+        }
+        _connQue.push_back(conn);
+        ++_connCnt;
+    }
+
+    _scanner = std::thread(&ConnectionPool::scannerConnectionTask, this);
+}
+
+ConnectionPool::~ConnectionPool() {
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _stop = true;
+    }
+    _scannerCv.notify_all();
+    _scanner.join();
+
+    for (MySQL *conn : _connQue) {
+        delete conn;
+    }
+}
+
+MySQL *ConnectionPool::createConnection() {
+    MySQL *conn = new MySQL();
+    if (!conn->connect()) {
+        delete conn;
+        return nullptr;
+    }
+    conn->refreshAliveTime();
+    return conn;
+}
+
+void ConnectionPool::bindThreadConnection(std::shared_ptr<MySQL> conn) {
+    t_threadConnection = std::move(conn);
+}
+
+std::shared_ptr<MySQL> ConnectionPool::getConnection() {
+    if (t_threadConnection) {
+        return t_threadConnection;
+    }
+
+    MySQL *conn = nullptr;
+    bool create = false;
+    {
+        std::unique_lock<std::mutex> lock(_queueMutex);
+        while (_connQue.empty()) {
+            if (_connCnt < _maxSize) {
+                // 还没到最大连接量，在锁外创建新连接
+                ++_connCnt;
+                create = true;
+                break;
+            }
+            if (std::cv_status::timeout ==
+                    _cv.wait_for(lock, std::chrono::milliseconds(
+                                           _connectionTimeout)) &&
+                _connQue.empty()) {
+                LOG_ERROR << "get mysql connection timeout!";
+                return nullptr;
+            }
+        }
+
+        if (!create) {
+            conn = _connQue.back();
+            _connQue.pop_back();
+        }
+    }
+
+    if (create) {
+        conn = createConnection();
+    } else if (conn->getIdleTime() >= _pingIdleTime && !conn->ping()) {
+        // 空闲太久的连接可能已被MySQL Server断开，重新建立连接
+        LOG_INFO << "mysql connection is broken, reconnect!";
+        delete conn;
+        conn = createConnection();
+    }
+
+    if (conn == nullptr) {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        --_connCnt;
+        _cv.notify_one();
+        return nullptr;
+    }
+
+    return std::shared_ptr<MySQL>(
+        conn, [this](MySQL *p) { releaseConnection(p); });
+}
+
+void ConnectionPool::releaseConnection(MySQL *conn) {
+    if (conn->isBroken()) {
+        // 使用中出现连接级错误的连接直接销毁，等待的线程可以创建新连接
+        LOG_INFO << "mysql connection is broken, discard!";
+        delete conn;
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            --_connCnt;
+        }
+        _cv.notify_one();
+        return;
+    }
+
+    conn->refreshAliveTime();
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _connQue.push_back(conn);
+    }
+    _cv.notify_one();
+}
+
+void ConnectionPool::scannerConnectionTask() {
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    while (!_stop) {
+        _scannerCv.wait_for(lock,
+                            std::chrono::milliseconds(_maxIdleTime / 2));
+        if (_stop) {
+            break;
+        }
+
+        // 队头是空闲最久的连接，超过最大空闲时间且多于初始连接量时回收
+        std::deque<MySQL *> expired;
+        while (_connCnt > _initSize && !_connQue.empty() &&
+               _connQue.front()->getIdleTime() >= _maxIdleTime) {
+            expired.push_back(_connQue.front());
+            _connQue.pop_front();
+            --_connCnt;
+        }
+
+        lock.unlock();
+        for (MySQL *conn : expired) {
+            delete conn;
+        }
+        lock.lock();
+    }
+}
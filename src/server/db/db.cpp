@@ -1,6 +1,8 @@
 #include "db.h"
 
 #include <muduo/base/Logging.h>
+#include <mysql/errmsg.h>
+#include <cstdlib>
 
 // 数据库配置信息
 static std::string server = "127.0.0.1";
@@ -9,10 +11,15 @@ static std::string password = "123456";
 static std::string dbname = "chat";
 
 // 初始化数据库连接
-MySQL::MySQL() { _conn = mysql_init(nullptr); }
+MySQL::MySQL() : _broken(false) {
+    _conn = mysql_init(nullptr);
+    refreshAliveTime();
+}
 
 // 释放数据库连接资源
 MySQL::~MySQL() {
+    // 预处理语句必须在连接关闭之前释放
+    _stmts.clear();
     if (_conn != nullptr)
         mysql_close(_conn);
 }
@@ -37,6 +44,7 @@ bool MySQL::connect() {
 bool MySQL::update(std::string sql) {
     if (mysql_query(_conn, sql.c_str())) {
         LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "更新失败!";
+        checkError(mysql_errno(_conn));
         return false;
     }
 
@@ -47,6 +55,7 @@ bool MySQL::update(std::string sql) {
 MYSQL_RES *MySQL::query(std::string sql) {
     if (mysql_query(_conn, sql.c_str())) {
         LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "查询失败!";
+        checkError(mysql_errno(_conn));
         return nullptr;
     }
 
@@ -54,4 +63,221 @@ MYSQL_RES *MySQL::query(std::string sql) {
 }
 
 // 获取连接
-MYSQL *MySQL::getConnection() { return _conn; }
\ No newline at end of file
+MYSQL *MySQL::getConnection() { return _conn; }
+
+// 获取sql对应的预处理语句
+MySQLStmt *MySQL::prepare(const std::string &sql) {
+    auto it = _stmts.find(sql);
+    if (it != _stmts.end()) {
+        return it->second.get();
+    }
+
+    MYSQL_STMT *stmt = mysql_stmt_init(_conn);
+    if (stmt == nullptr) {
+        return nullptr;
+    }
+    std::unique_ptr<MySQLStmt> prepared(new MySQLStmt(this, stmt));
+    if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()) || !prepared->init()) {
+        LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "准备失败!"
+                 << mysql_stmt_error(stmt);
+        checkError(mysql_stmt_errno(stmt));
+        return nullptr;
+    }
+    return _stmts.emplace(sql, std::move(prepared)).first->second.get();
+}
+
+// 生成count个以','分隔的参数占位符
+std::string MySQL::placeholders(size_t count) {
+    std::string str;
+    str.reserve(count * 2);
+    for (size_t i = 0; i < count; ++i) {
+        str += (i == 0) ? "?" : ",?";
+    }
+    return str;
+}
+
+// 检测连接是否可用
+bool MySQL::ping() { return mysql_ping(_conn) == 0; }
+
+// 连接是否已经断开
+bool MySQL::isBroken() const { return _broken; }
+
+// 根据错误码判断连接是否断开
+void MySQL::checkError(unsigned int err) {
+    switch (err) {
+    case CR_CONNECTION_ERROR:
+    case CR_CONN_HOST_ERROR:
+    case CR_SERVER_GONE_ERROR:
+    case CR_SERVER_LOST:
+    case CR_SERVER_LOST_EXTENDED:
+    case CR_COMMANDS_OUT_OF_SYNC:
+        _broken = true;
+        break;
+    default:
+        break;
+    }
+}
+
+// 刷新连接进入空闲状态的时间点
+void MySQL::refreshAliveTime() { _aliveTime = std::chrono::steady_clock::now(); }
+
+// 返回连接已经空闲的时长(ms)
+long long MySQL::getIdleTime() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - _aliveTime)
+        .count();
+}
+
+// 字符串结果列的初始缓冲区大小，超出时按实际长度扩大
+static const unsigned long kInitColumnSize = 256;
+
+MySQLStmt::MySQLStmt(MySQL *owner, MYSQL_STMT *stmt)
+    : _owner(owner), _stmt(stmt) {}
+
+MySQLStmt::~MySQLStmt() { mysql_stmt_close(_stmt); }
+
+// 准备结果集的接收缓冲区
+bool MySQLStmt::init() {
+    unsigned long paramCount = mysql_stmt_param_count(_stmt);
+    _params.assign(paramCount, MYSQL_BIND());
+    _intParams.assign(paramCount, 0);
+    _paramLengths.assign(paramCount, 0);
+
+    MYSQL_RES *meta = mysql_stmt_result_metadata(_stmt);
+    if (meta == nullptr) {
+        // 不是查询语句，没有结果集
+        return true;
+    }
+    unsigned int fieldCount = mysql_num_fields(meta);
+    MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+    _columns.resize(fieldCount);
+    _results.assign(fieldCount, MYSQL_BIND());
+    for (unsigned int i = 0; i < fieldCount; ++i) {
+        Column &column = _columns[i];
+        MYSQL_BIND &bind = _results[i];
+        switch (fields[i].type) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_LONGLONG:
+            column.isInt = true;
+            bind.buffer_type = MYSQL_TYPE_LONGLONG;
+            bind.buffer = &column.intValue;
+            break;
+        default:
+            column.buffer.resize(kInitColumnSize);
+            bind.buffer_type = MYSQL_TYPE_STRING;
+            bind.buffer = column.buffer.data();
+            bind.buffer_length = column.buffer.size();
+            break;
+        }
+        bind.length = &column.length;
+        bind.is_null = &column.isNull;
+        bind.error = &column.error;
+    }
+    mysql_free_result(meta);
+    return true;
+}
+
+void MySQLStmt::setInt(int index, long long value) {
+    _intParams[index] = value;
+    MYSQL_BIND &bind = _params[index];
+    bind.buffer_type = MYSQL_TYPE_LONGLONG;
+    bind.buffer = &_intParams[index];
+    bind.length = nullptr;
+}
+
+void MySQLStmt::setString(int index, const std::string &value) {
+    _paramLengths[index] = value.size();
+    MYSQL_BIND &bind = _params[index];
+    bind.buffer_type = MYSQL_TYPE_STRING;
+    bind.buffer = const_cast<char *>(value.data());
+    bind.buffer_length = value.size();
+    bind.length = &_paramLengths[index];
+}
+
+// 执行语句
+bool MySQLStmt::execute() {
+    // 释放上一次执行没有读完的结果集
+    mysql_stmt_free_result(_stmt);
+
+    if ((!_params.empty() && mysql_stmt_bind_param(_stmt, _params.data())) ||
+        mysql_stmt_execute(_stmt)) {
+        LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << "执行失败!"
+                 << mysql_stmt_error(_stmt);
+        _owner->checkError(mysql_stmt_errno(_stmt));
+        return false;
+    }
+
+    // 连接归还连接池后会执行其它语句，结果集先全部读到客户端
+    if (!_results.empty() &&
+        (mysql_stmt_bind_result(_stmt, _results.data()) ||
+         mysql_stmt_store_result(_stmt))) {
+        LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << "查询失败!"
+                 << mysql_stmt_error(_stmt);
+        _owner->checkError(mysql_stmt_errno(_stmt));
+        return false;
+    }
+    return true;
+}
+
+// 读取结果集的下一行
+bool MySQLStmt::fetch() {
+    int ret = mysql_stmt_fetch(_stmt);
+    if (ret == MYSQL_DATA_TRUNCATED) {
+        // 字符串超出缓冲区，扩大缓冲区后重新读取被截断的列
+        bool rebind = false;
+        for (size_t i = 0; i < _columns.size(); ++i) {
+            Column &column = _columns[i];
+            if (column.isInt || column.length <= column.buffer.size()) {
+                continue;
+            }
+            column.buffer.resize(column.length);
+            _results[i].buffer = column.buffer.data();
+            _results[i].buffer_length = column.buffer.size();
+            if (mysql_stmt_fetch_column(_stmt, &_results[i], i, 0)) {
+                _owner->checkError(mysql_stmt_errno(_stmt));
+                return false;
+            }
+            rebind = true;
+        }
+        if (rebind && mysql_stmt_bind_result(_stmt, _results.data())) {
+            return false;
+        }
+        return true;
+    }
+    if (ret == 1) {
+        _owner->checkError(mysql_stmt_errno(_stmt));
+    }
+    return ret == 0;
+}
+
+long long MySQLStmt::getInt(int index) const {
+    const Column &column = _columns[index];
+    if (column.isNull) {
+        return 0;
+    }
+    return column.isInt ? column.intValue
+                        : atoll(getString(index).c_str());
+}
+
+std::string MySQLStmt::getString(int index) const {
+    const Column &column = _columns[index];
+    if (column.isNull) {
+        return "";
+    }
+    if (column.isInt) {
+        return std::to_string(column.intValue);
+    }
+    return std::string(column.buffer.data(), column.length);
+}
+
+// 查询语句结果集的行数
+long long MySQLStmt::rowCount() { return mysql_stmt_num_rows(_stmt); }
+
+// insert语句生成的自增主键
+long long MySQLStmt::insertId() { return mysql_stmt_insert_id(_stmt); }
+
+// 语句影响的行数
+long long MySQLStmt::affectedRows() { return mysql_stmt_affected_rows(_stmt); }
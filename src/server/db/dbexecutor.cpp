@@ -0,0 +1,108 @@
+#include "dbexecutor.hpp"
+#include "connectionpool.hpp"
+
+#include <muduo/base/Logging.h>
+
+// 数据库线程数量
+static const int kThreadNum = 4;
+
+bool DBRequest::cancel() {
+    int expected = kPending;
+    return _state.compare_exchange_strong(expected, kCancelled);
+}
+
+DBExecutor *DBExecutor::instance() {
+    static DBExecutor executor;
+    return &executor;
+}
+
+DBExecutor::DBExecutor() : _stop(false) {
+    // 先创建连接池，保证连接池在执行器之后析构
+    ConnectionPool::instance();
+
+    for (int i = 0; i < kThreadNum; ++i) {
+        _threads.emplace_back(&DBExecutor::threadFunc, this);
+    }
+}
+
+DBExecutor::~DBExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    for (std::thread &t : _threads) {
+        t.join();
+    }
+}
+
+DBRequestPtr DBExecutor::submit(EventLoop *loop, Query query, Callback done,
+                                int timeoutMs, ConnectionPolicy policy) {
+    DBRequestPtr request = std::make_shared<DBRequest>();
+    request->_bindConnection = policy == kBindConnection;
+    request->_loop = loop;
+    request->_query = std::move(query);
+    request->_done = std::move(done);
+    request->_deadline =
+        timeoutMs > 0 ? std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(timeoutMs)
+                      : std::chrono::steady_clock::time_point::max();
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _queue.push_back(request);
+    }
+    _cv.notify_one();
+    return request;
+}
+
+void DBExecutor::complete(const DBRequestPtr &request, bool ok) {
+    if (request->_done) {
+        request->_loop->runInLoop([request, ok]() { request->_done(ok); });
+    }
+}
+
+void DBExecutor::threadFunc() {
+    for (;;) {
+        DBRequestPtr request;
+        {
+            std::unique_lock<std::mutex> lock(_queueMutex);
+            _cv.wait(lock, [this]() { return _stop || !_queue.empty(); });
+            if (_stop) {
+                return;
+            }
+            request = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        // 已经取消的请求直接丢弃
+        int expected = DBRequest::kPending;
+        if (!request->_state.compare_exchange_strong(expected,
+                                                     DBRequest::kRunning)) {
+            continue;
+        }
+        if (std::chrono::steady_clock::now() > request->_deadline) {
+            LOG_INFO << "db request timeout before execution";
+            complete(request, false);
+            continue;
+        }
+
+        if (!request->_bindConnection) {
+            request->_query();
+            complete(request, true);
+            continue;
+        }
+
+        // 执行期间当前线程绑定一个连接，请求中的多个Model操作不再反复从连接池取连接
+        std::shared_ptr<MySQL> conn = ConnectionPool::instance()->getConnection();
+        if (!conn) {
+            complete(request, false);
+            continue;
+        }
+        ConnectionPool::bindThreadConnection(conn);
+        request->_query();
+        ConnectionPool::bindThreadConnection(nullptr);
+        conn.reset();
+
+        complete(request, true);
+    }
+}
@@ -0,0 +1,84 @@
+#include "jsoncodec.hpp"
+#include "loopinbox.hpp"
+#include "public.hpp"
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/Endian.h>
+#include <muduo/net/EventLoop.h>
+
+JsonCodec::JsonCodec(const JsonMessageCallback &cb) : messageCallback_(cb) {}
+
+void JsonCodec::onMessage(const TcpConnectionPtr &conn, Buffer *buffer,
+                          Timestamp time) {
+    // 一次可读事件中可能包含多个消息帧，循环取出所有完整的帧
+    while (buffer->readableBytes() >= MSG_HEADER_LEN) {
+        const int32_t len = buffer->peekInt32();
+        if (len < 0 || len > MSG_MAX_LEN) {
+            // 非法数据不会再被读取，只关闭写端时对端继续发送会让Buffer无限增长，直接关闭连接
+            LOG_ERROR << conn->name() << " invalid message length " << len;
+            conn->forceClose();
+            break;
+        }
+        if (buffer->readableBytes() <
+            static_cast<size_t>(MSG_HEADER_LEN + len)) {
+            // 半包，等待剩余数据到达
+            break;
+        }
+
+        // 直接在Buffer的内存上反序列化，不拷贝到string
+        const char *body = buffer->peek() + MSG_HEADER_LEN;
+        json js = json::parse(body, body + len, nullptr, false);
+        buffer->retrieve(MSG_HEADER_LEN + len);
+
+        if (js.is_discarded()) {
+            LOG_ERROR << conn->name() << " invalid json message";
+            continue;
+        }
+        messageCallback_(conn, js, time);
+    }
+}
+
+void JsonCodec::send(const TcpConnectionPtr &conn, const std::string &msg) {
+    if (!conn->getLoop()->isInLoopThread()) {
+        // 跨线程发送和sendFrame走同一个投递队列，同一发送方的消息不会乱序
+        sendFrame(conn, encode(msg));
+        return;
+    }
+
+    Buffer buffer;
+    buffer.append(msg.data(), msg.size());
+    buffer.prependInt32(static_cast<int32_t>(msg.size()));
+    conn->send(&buffer);
+}
+
+std::shared_ptr<const std::string> JsonCodec::encode(const std::string &msg) {
+    return encode(msg.data(), msg.size());
+}
+
+std::shared_ptr<const std::string> JsonCodec::encode(const char *data,
+                                                     size_t len) {
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(MSG_HEADER_LEN + len);
+    int32_t be32 = sockets::hostToNetwork32(static_cast<int32_t>(len));
+    frame->append(reinterpret_cast<const char *>(&be32), sizeof be32);
+    frame->append(data, len);
+    return frame;
+}
+
+void JsonCodec::sendFrame(const TcpConnectionPtr &conn,
+                          const std::shared_ptr<const std::string> &frame) {
+    EventLoop *loop = conn->getLoop();
+    if (loop->isInLoopThread()) {
+        conn->send(*frame);
+        return;
+    }
+
+    // 跨线程时只传递智能指针，由连接所属的loop发送同一份数据
+    // 放入IO线程的无锁投递队列，一批消息只唤醒一次IO线程
+    LoopInbox *inbox = LoopInbox::find(loop);
+    if (inbox != nullptr) {
+        inbox->post(conn, frame);
+    } else {
+        loop->runInLoop([conn, frame]() { conn->send(*frame); });
+    }
+}
@@ -0,0 +1,55 @@
+#include "loopinbox.hpp"
+
+#include <atomic>
+#include <muduo/base/Logging.h>
+#include <mutex>
+#include <vector>
+
+// 最多支持的IO线程数
+static const size_t kMaxInboxNum = 64;
+// 所有IO线程的投递队列，只追加不删除，和IO线程一样存活到进程退出
+static LoopInbox *inboxes[kMaxInboxNum];
+// 已经创建的投递队列数，先写入数组再发布计数
+// redis观察线程可能在TcpServer::start之前就开始投递，查找时只访问计数以内的元素，不需要加锁
+static std::atomic<size_t> inboxCount(0);
+// IO线程并发初始化时保护inboxes的写入
+static std::mutex inboxesMutex;
+
+void LoopInbox::create(EventLoop *loop) {
+    std::lock_guard<std::mutex> lock(inboxesMutex);
+    size_t count = inboxCount.load(std::memory_order_relaxed);
+    if (count == kMaxInboxNum) {
+        LOG_ERROR << "too many io loops, inbox is not created!";
+        return;
+    }
+    inboxes[count] = new LoopInbox(loop);
+    inboxCount.store(count + 1, std::memory_order_release);
+}
+
+LoopInbox *LoopInbox::find(EventLoop *loop) {
+    size_t count = inboxCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (inboxes[i]->loop_ == loop) {
+            return inboxes[i];
+        }
+    }
+    return nullptr;
+}
+
+LoopInbox::LoopInbox(EventLoop *loop) : loop_(loop) {}
+
+void LoopInbox::post(const TcpConnectionPtr &conn,
+                     const std::shared_ptr<const std::string> &frame) {
+    if (queue_.push(std::make_pair(conn, frame))) {
+        loop_->queueInLoop(std::bind(&LoopInbox::drain, this));
+    }
+}
+
+void LoopInbox::drain() {
+    std::vector<std::pair<TcpConnectionPtr, std::shared_ptr<const std::string>>>
+        items;
+    queue_.popAll(items);
+    for (const auto &item : items) {
+        item.first->send(*item.second);
+    }
+}
@@ -3,12 +3,19 @@
 
 #include <iostream>
 #include <signal.h>
+#include <unistd.h>
 
 using namespace std;
 
+// 主线程的事件循环
+static EventLoop *g_loop = nullptr;
+
+// 信号处理函数中只能执行异步信号安全的操作，这里只通知事件循环退出
+// 写入缓冲区、清理在线状态等业务重置在loop返回后的main中执行
 void resetHandler(int) {
-    ChatService::instance()->reset();
-    exit(0);
+    if (g_loop != nullptr) {
+        g_loop->quit();
+    }
 }
 
 
@@ -16,7 +23,7 @@ int main(int argc, char **argv)
 {
     if (argc < 3)
     {
-        cerr << "command invalid! example: ./ChatServer 127.0.0.1 6000" << endl;
+        cerr << "command invalid! example: ./ChatServer 127.0.0.1 6000 [stream] [nodeid]" << endl;
         exit(-1);
     }
 
@@ -24,14 +31,44 @@ int main(int argc, char **argv)
     char *ip = argv[1];
     uint16_t port = atoi(argv[2]);
 
-    signal(SIGINT, resetHandler);
+    // 可选参数：stream表示跨节点消息改用Redis Stream投递，默认使用发布-订阅
+    // 其它参数作为本服务器节点在集群中的唯一标识
+    string nodeid;
+    for (int i = 3; i < argc; ++i)
+    {
+        if (string(argv[i]) == "stream")
+        {
+            ChatService::instance()->setDeliveryMode(Redis::STREAM);
+        }
+        else
+        {
+            nodeid = argv[i];
+        }
+    }
+    // 没有指定时用 主机名:端口:进程id，监听地址可能是0.0.0.0，不同主机上会重复
+    if (nodeid.empty())
+    {
+        char hostname[256] = {0};
+        gethostname(hostname, sizeof hostname - 1);
+        nodeid = string(hostname) + ":" + to_string(port) + ":" + to_string(getpid());
+    }
 
     EventLoop loop;
-    InetAddress addr(ip, port);
-    ChatServer server(&loop, addr, "ChatServer");
+    {
+        InetAddress addr(ip, port);
+        ChatServer server(&loop, addr, "ChatServer", nodeid);
+
+        g_loop = &loop;
+        signal(SIGINT, resetHandler);
 
-    server.start();
-    loop.loop();
+        server.start();
+        loop.loop();
 
+        // 收到退出信号，先析构服务器：停止续约线程，关闭所有连接并停止IO线程和业务线程
+        // 否则重置之后续约线程发现租约不存在，会把连接表中的用户重新登记回在线用户目录
+    }
+
+    // 重置业务状态后退出
+    ChatService::instance()->reset();
     return 0;
 }
\ No newline at end of file
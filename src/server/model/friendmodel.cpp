@@ -1,42 +1,36 @@
 #include "friendmodel.hpp"
-#include "db.h"
+#include "connectionpool.hpp"
 
 void FriendModel::insert(int userid, int friendid) {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "insert into friend values(%d,%d)", userid, friendid);
-
-    MySQL mysql;
-    if (mysql.connect()) {
-        mysql.update(sql);
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare("insert into friend values(?, ?)");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            stmt->setInt(1, friendid);
+            stmt->execute();
+        }
     }
 }
 
 std::vector<User> FriendModel::query(int userid) {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-
-    sprintf(sql,
-            "select a.id,a.name,a.state from user a inner join friend b on "
-            "b.friendid = a.id where b.userid =%d",
-            userid);
-
     std::vector<User> vec;
-    MySQL mysql;
-    if (mysql.connect()) {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr) {
-
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr) {
-                User user;
-                user.setId(atoi(row[0]));
-                user.setName(row[1]);
-                user.setState(row[2]);
-                vec.push_back(user);
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "select a.id,a.name,a.state from user a inner join friend b on "
+            "b.friendid = a.id where b.userid = ?");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            if (stmt->execute()) {
+                while (stmt->fetch()) {
+                    User user;
+                    user.setId(stmt->getInt(0));
+                    user.setName(stmt->getString(1));
+                    user.setState(stmt->getString(2));
+                    vec.push_back(user);
+                }
             }
-            mysql_free_result(res);
-            return vec;
         }
     }
     return vec;
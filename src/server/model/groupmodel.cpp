@@ -1,21 +1,25 @@
 #include "groupmodel.hpp"
-#include "db.h"
+#include "connectionpool.hpp"
 
 // 创建群组
 bool GroupModel::createGroup(Group &group)
 {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "insert into allgroup(groupname, groupdesc) values('%s', '%s')",
-            group.getName().c_str(), group.getDesc().c_str());
+    std::string name = group.getName();
+    std::string desc = group.getDesc();
 
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql)
     {
-        if (mysql.update(sql))
+        MySQLStmt *stmt = mysql->prepare("insert into allgroup(groupname, groupdesc) values(?, ?)");
+        if (stmt != nullptr)
         {
-            group.setId(mysql_insert_id(mysql.getConnection()));
-            return true;
+            stmt->setString(0, name);
+            stmt->setString(1, desc);
+            if (stmt->execute())
+            {
+                group.setId(stmt->insertId());
+                return true;
+            }
         }
     }
 
@@ -25,15 +29,17 @@ bool GroupModel::createGroup(Group &group)
 // 加入群组
 void GroupModel::addGroup(int userid, int groupid, std::string role)
 {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "insert into groupuser values(%d, %d, '%s')",
-            groupid, userid, role.c_str());
-
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql)
     {
-        mysql.update(sql);
+        MySQLStmt *stmt = mysql->prepare("insert into groupuser values(?, ?, ?)");
+        if (stmt != nullptr)
+        {
+            stmt->setInt(0, groupid);
+            stmt->setInt(1, userid);
+            stmt->setString(2, role);
+            stmt->execute();
+        }
     }
 }
 
@@ -41,58 +47,82 @@ void GroupModel::addGroup(int userid, int groupid, std::string role)
 std::vector<Group> GroupModel::queryGroups(int userid)
 {
     /*
-    1. 先根据userid在groupuser表中查询出该用户所属的群组信息
-    2. 在根据群组信息，查询属于该群组的所有用户的userid，并且和user表进行多表联合查询，查出用户的详细信息
+    1. 先根据userid查询出该用户所属的群组信息和每个群组的成员数
+    2. 再一次查询出这些群组的所有成员，和user表联合查询出用户的详细信息
+    两次查询的结果都按群组id排序，成员按顺序归入对应的群组，查询次数和群组数量无关
     */
-    char sql[1024] = {0};
-    sprintf(sql, "select a.id,a.groupname,a.groupdesc from allgroup a inner join \
-         groupuser b on a.id = b.groupid where b.userid=%d",
-            userid);
-
     std::vector<Group> groupVec;
 
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (!mysql)
     {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
-        {
-            MYSQL_ROW row;
-            // 查出userid所有的群组信息
-            while ((row = mysql_fetch_row(res)) != nullptr)
-            {
-                Group group;
-                group.setId(atoi(row[0]));
-                group.setName(row[1]);
-                group.setDesc(row[2]);
-                groupVec.push_back(group);
-            }
-            mysql_free_result(res);
-        }
+        return groupVec;
     }
 
-    // 查询群组的用户信息
-    for (Group &group : groupVec)
+    MySQLStmt *stmt = mysql->prepare("select a.id,a.groupname,a.groupdesc, \
+        (select count(*) from groupuser c where c.groupid = a.id) \
+        from allgroup a inner join groupuser b on a.id = b.groupid where b.userid = ? order by a.id");
+    if (stmt == nullptr)
+    {
+        return groupVec;
+    }
+    stmt->setInt(0, userid);
+    if (!stmt->execute())
+    {
+        return groupVec;
+    }
+    // 结果集已经全部读到客户端，按行数和成员数预留空间
+    groupVec.reserve(stmt->rowCount());
+    while (stmt->fetch())
+    {
+        Group group;
+        group.setId(stmt->getInt(0));
+        group.setName(stmt->getString(1));
+        group.setDesc(stmt->getString(2));
+        group.getUsers().reserve(stmt->getInt(3));
+        groupVec.push_back(std::move(group));
+    }
+    if (groupVec.empty())
     {
-        sprintf(sql, "select a.id,a.name,a.state,b.grouprole from user a \
-            inner join groupuser b on b.userid = a.id where b.groupid=%d",
-                group.getId());
+        return groupVec;
+    }
 
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
+    // 查询所有群组的用户信息
+    stmt = mysql->prepare("select m.groupid,u.id,u.name,u.state,m.grouprole from groupuser b \
+        inner join groupuser m on m.groupid = b.groupid inner join user u on u.id = m.userid \
+        where b.userid = ? order by m.groupid");
+    if (stmt == nullptr)
+    {
+        return groupVec;
+    }
+    stmt->setInt(0, userid);
+    if (!stmt->execute())
+    {
+        return groupVec;
+    }
+    size_t index = 0;
+    while (stmt->fetch())
+    {
+        int groupid = stmt->getInt(0);
+        while (index < groupVec.size() && groupVec[index].getId() < groupid)
         {
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
-            {
-                GroupUser user;
-                user.setId(atoi(row[0]));
-                user.setName(row[1]);
-                user.setState(row[2]);
-                user.setRole(row[3]);
-                group.getUsers().push_back(user);
-            }
-            mysql_free_result(res);
+            ++index;
         }
+        if (index == groupVec.size())
+        {
+            break;
+        }
+        if (groupVec[index].getId() != groupid)
+        {
+            continue;
+        }
+
+        GroupUser user;
+        user.setId(stmt->getInt(1));
+        user.setName(stmt->getString(2));
+        user.setState(stmt->getString(3));
+        user.setRole(stmt->getString(4));
+        groupVec[index].getUsers().push_back(std::move(user));
     }
     return groupVec;
 }
@@ -100,23 +130,23 @@ std::vector<Group> GroupModel::queryGroups(int userid)
 // 根据指定的groupid查询群组用户id列表，除userid自己，主要用户群聊业务给群组其它成员群发消息
 std::vector<int> GroupModel::queryGroupUsers(int userid, int groupid)
 {
-    char sql[1024] = {0};
-    sprintf(sql, "select userid from groupuser where groupid = %d and userid != %d", groupid, userid);
-
     std::vector<int> idVec;
-    MySQL mysql;
-    if (mysql.connect())
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql)
     {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr)
+        MySQLStmt *stmt = mysql->prepare("select userid from groupuser where groupid = ? and userid != ?");
+        if (stmt != nullptr)
         {
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
+            stmt->setInt(0, groupid);
+            stmt->setInt(1, userid);
+            if (stmt->execute())
             {
-                idVec.push_back(atoi(row[0]));
+                while (stmt->fetch())
+                {
+                    idVec.push_back(stmt->getInt(0));
+                }
             }
-            mysql_free_result(res);
         }
     }
     return idVec;
-}
\ No newline at end of file
+}
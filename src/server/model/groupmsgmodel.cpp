@@ -0,0 +1,117 @@
+#include "groupmsgmodel.hpp"
+#include "connectionpool.hpp"
+
+long long GroupMsgModel::insert(int groupid, const std::string &msg) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "insert into groupmessage(groupid, message) values(?, ?)");
+        if (stmt != nullptr) {
+            stmt->setInt(0, groupid);
+            stmt->setString(1, msg);
+            if (stmt->execute()) {
+                return stmt->insertId();
+            }
+        }
+    }
+    return -1;
+}
+
+std::vector<std::string>
+GroupMsgModel::query(int userid, std::unordered_map<int, long long> &cursors) {
+    std::vector<std::string> vec;
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "select m.groupid, m.id, m.message from groupmessage m inner join groupuser b on "
+            "b.groupid = m.groupid left join groupcursor c on c.userid = "
+            "b.userid and c.groupid = b.groupid where b.userid = ? and "
+            "m.id > ifnull(c.msgid, 0) order by m.id");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            if (stmt->execute()) {
+                // 结果按序号排列，每个群组最后读到的就是该群组中的最大序号
+                // 查询之后才写入的群消息不会被跳过
+                while (stmt->fetch()) {
+                    cursors[stmt->getInt(0)] = stmt->getInt(1);
+                    vec.push_back(stmt->getString(2));
+                }
+            }
+        }
+    }
+    return vec;
+}
+
+void GroupMsgModel::updateCursor(int userid) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "insert into groupcursor(userid, groupid, msgid) select b.userid, "
+            "b.groupid, ifnull((select max(m.id) from groupmessage m where "
+            "m.groupid = b.groupid), 0) from groupuser b where b.userid = ? "
+            "on duplicate key update msgid = values(msgid)");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            stmt->execute();
+        }
+    }
+}
+
+void GroupMsgModel::updateCursor(int userid, int groupid) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "insert into groupcursor(userid, groupid, msgid) select ?, ?, "
+            "ifnull(max(id), 0) from groupmessage where groupid = ? "
+            "on duplicate key update msgid = values(msgid)");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            stmt->setInt(1, groupid);
+            stmt->setInt(2, groupid);
+            stmt->execute();
+        }
+    }
+}
+
+void GroupMsgModel::updateCursor(
+    int userid, const std::unordered_map<int, long long> &cursors) {
+    if (cursors.empty()) {
+        return;
+    }
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "insert into groupcursor(userid, groupid, msgid) values(?, ?, ?) "
+            "on duplicate key update msgid = greatest(msgid, values(msgid))");
+        if (stmt != nullptr) {
+            for (const auto &cursor : cursors) {
+                stmt->setInt(0, userid);
+                stmt->setInt(1, cursor.first);
+                stmt->setInt(2, cursor.second);
+                if (!stmt->execute()) {
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void GroupMsgModel::prune(int userid) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        // 每个群组中最小的读游标之前的消息已经被所有成员读过，没有读游标的成员按0计算
+        // 保留读游标指向的那条消息，表中序号最大的消息不会被删除
+        // 避免MySQL重启后自增序号从更小的值重新开始，新消息的序号落到读游标之前
+        MySQLStmt *stmt = mysql->prepare(
+            "delete m from groupmessage m inner join (select b.groupid, "
+            "min(ifnull(c.msgid, 0)) as msgid from groupuser b left join "
+            "groupcursor c on c.userid = b.userid and c.groupid = b.groupid "
+            "where b.groupid in (select groupid from groupuser where userid = "
+            "?) group by b.groupid) t on t.groupid = m.groupid where m.id < "
+            "t.msgid");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            stmt->execute();
+        }
+    }
+}
@@ -1,48 +1,156 @@
 #include "offlinemessagemodel.hpp"
-#include "db.h"
+#include "connectionpool.hpp"
 
-void OfflineMsgModel::insert(int userid, std::string msg) {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "insert into offlinemessage values('%d','%s')", userid,
-            msg.c_str());
+#include <muduo/base/Logging.h>
 
-    MySQL mysql;
-    if (mysql.connect()) {
-        mysql.update(sql);
+void OfflineMsgModel::insert(int userid, const std::string &msg) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "insert into offlinemessage(userid, message) values(?, ?)");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            stmt->setString(1, msg);
+            stmt->execute();
+        }
     }
 }
 
-void OfflineMsgModel::remove(int userid) {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "delete from offlinemessage where userid = %d", userid);
+// 单条多行insert语句最多包含的行数和消息字节数
+// 整条语句连同参数作为一个包发给服务器，字节数远小于max_allowed_packet的默认值(4MB)
+static const size_t kMaxRowsPerInsert = 256;
+static const size_t kMaxBytesPerInsert = 1024 * 1024;
 
-    MySQL mysql;
-    if (mysql.connect()) {
-        mysql.update(sql);
+// 在一个事务中用多行insert写入所有离线消息，任何一条语句失败都返回false，调用者负责回滚
+static bool
+insertBatches(MySQL &mysql,
+              const std::vector<std::pair<int, std::string>> &msgVec) {
+    if (!mysql.update("start transaction")) {
+        return false;
+    }
+    size_t begin = 0;
+    while (begin < msgVec.size()) {
+        // 先按行数和字节数上限算出这一批能放下的行数，至少一行
+        size_t fit = 0;
+        size_t bytes = 0;
+        while (begin + fit < msgVec.size() && fit < kMaxRowsPerInsert) {
+            bytes += msgVec[begin + fit].second.size();
+            if (fit > 0 && bytes > kMaxBytesPerInsert) {
+                break;
+            }
+            ++fit;
+        }
+        // 每条多行insert的行数取不超过它的2的幂，只需要少数几条预处理语句
+        size_t rows = 1;
+        while (rows * 2 <= fit) {
+            rows *= 2;
+        }
+
+        std::string sql =
+            "insert into offlinemessage(userid, message) values(?, ?)";
+        for (size_t i = 1; i < rows; ++i) {
+            sql += ",(?, ?)";
+        }
+        MySQLStmt *stmt = mysql.prepare(sql);
+        if (stmt == nullptr) {
+            return false;
+        }
+        // 消息按二进制参数传输，不需要转义
+        for (size_t i = 0; i < rows; ++i) {
+            stmt->setInt(2 * i, msgVec[begin + i].first);
+            stmt->setString(2 * i + 1, msgVec[begin + i].second);
+        }
+        if (!stmt->execute()) {
+            return false;
+        }
+        begin += rows;
     }
+    return mysql.update("commit");
 }
 
-std::vector<std::string> OfflineMsgModel::query(int userid) {
+// 在一个事务中逐行写入，某一行出错时InnoDB只回滚这一条语句，丢弃这一行后继续写入其它行
+// 连接断开时返回false，事务没有提交，所有消息都没有写入
+static bool insertRows(MySQL &mysql,
+                       const std::vector<std::pair<int, std::string>> &msgVec) {
+    if (!mysql.update("start transaction")) {
+        return false;
+    }
+    MySQLStmt *stmt = mysql.prepare(
+        "insert into offlinemessage(userid, message) values(?, ?)");
+    if (stmt == nullptr) {
+        mysql.update("rollback");
+        return false;
+    }
+    for (const auto &msg : msgVec) {
+        stmt->setInt(0, msg.first);
+        stmt->setString(1, msg.second);
+        if (!stmt->execute()) {
+            if (mysql.isBroken()) {
+                return false;
+            }
+            LOG_ERROR << "drop offline message of user " << msg.first
+                      << ", length " << msg.second.size();
+        }
+    }
+    return mysql.update("commit");
+}
+
+bool OfflineMsgModel::insert(
+    const std::vector<std::pair<int, std::string>> &msgVec) {
+    if (msgVec.empty()) {
+        return true;
+    }
 
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "select message from offlinemessage where userid = %d",
-            userid);
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (!mysql) {
+        return false;
+    }
+
+    if (insertBatches(*mysql, msgVec)) {
+        return true;
+    }
+    mysql->update("rollback");
+    if (mysql->isBroken()) {
+        return false;
+    }
+    // 不是连接出错，是某些行本身写不进去（字符集不符、超过包大小等），重试也不会成功
+    // 改为逐行写入，只丢弃写不进去的行，不让它们一直堵住之后的离线消息
+    LOG_ERROR << "write " << msgVec.size()
+              << " offline messages in batch failed, write one by one";
+    return insertRows(*mysql, msgVec);
+}
+
+bool OfflineMsgModel::remove(int userid, long long maxid) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "delete from offlinemessage where userid = ? and id <= ?");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            stmt->setInt(1, maxid);
+            return stmt->execute();
+        }
+    }
+    return false;
+}
 
+std::vector<std::string> OfflineMsgModel::query(int userid, long long &maxid) {
     std::vector<std::string> vec;
-    MySQL mysql;
-    if (mysql.connect()) {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr) {
-            // 把userid用户的所有离线消息放入vec中返回
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr) {
-                vec.push_back(row[0]);
+    maxid = 0;
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "select id, message from offlinemessage where userid = ? order by "
+            "id");
+        if (stmt != nullptr) {
+            stmt->setInt(0, userid);
+            if (stmt->execute()) {
+                // 把userid用户的所有离线消息放入vec中返回
+                while (stmt->fetch()) {
+                    maxid = stmt->getInt(0);
+                    vec.push_back(stmt->getString(1));
+                }
             }
-            mysql_free_result(res);
-            return vec;
         }
     }
     return vec;
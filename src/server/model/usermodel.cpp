@@ -1,21 +1,22 @@
 #include "usermodel.hpp"
-#include "db.h"
-#include <iostream>
+#include "connectionpool.hpp"
 
-bool UserModel::insert(User &user) {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql,
-            "insert into user(name, password, state) values('%s','%s','%s')",
-            user.getName().c_str(), user.getPassword().c_str(),
-            user.getState().c_str());
+#include <algorithm>
 
-    MySQL mysql;
-    if (mysql.connect()) {
-        if (mysql.update(sql)) {
-            // 获取插入成功的用户数据生成的主键
-            user.setId(mysql_insert_id(mysql.getConnection()));
-            return true;
+bool UserModel::insert(User &user) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "insert into user(name, password, state) values(?, ?, ?)");
+        if (stmt != nullptr) {
+            stmt->setString(0, user.getName());
+            stmt->setString(1, user.getPassword());
+            stmt->setString(2, user.getState());
+            if (stmt->execute()) {
+                // 获取插入成功的用户数据生成的主键
+                user.setId(stmt->insertId());
+                return true;
+            }
         }
     }
 
@@ -23,23 +24,18 @@ bool UserModel::insert(User &user) {
 }
 
 User UserModel::query(int id) {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "select * from user where id = %d", id);
-
-    MySQL mysql;
-    if (mysql.connect()) {
-        MYSQL_RES *res = mysql.query(sql);
-        if (res != nullptr) {
-            MYSQL_ROW row = mysql_fetch_row(res);
-            if (row != nullptr) {
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt = mysql->prepare(
+            "select id, name, password, state from user where id = ?");
+        if (stmt != nullptr) {
+            stmt->setInt(0, id);
+            if (stmt->execute() && stmt->fetch()) {
                 User user;
-                user.setId(atoi(row[0]));
-                user.setName(row[1]);
-                user.setPassword(row[2]);
-                user.setState(row[3]);
-
-                mysql_free_result(res);
+                user.setId(stmt->getInt(0));
+                user.setName(stmt->getString(1));
+                user.setPassword(stmt->getString(2));
+                user.setState(stmt->getString(3));
                 return user;
             }
         }
@@ -49,27 +45,64 @@ User UserModel::query(int id) {
 }
 
 bool UserModel::updateState(User user) {
-    // 1.组装sql语句
-    char sql[1024] = {0};
-
-    sprintf(sql, "update user set state = '%s' where id = %d",
-            user.getState().c_str(), user.getId());
-
-    MySQL mysql;
-    if (mysql.connect()) {
-        if (mysql.update(sql)) {
-            return true;
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (mysql) {
+        MySQLStmt *stmt =
+            mysql->prepare("update user set state = ? where id = ?");
+        if (stmt != nullptr) {
+            stmt->setString(0, user.getState());
+            stmt->setInt(1, user.getId());
+            return stmt->execute();
         }
     }
     return false;
 }
 
-void UserModel::resetState() {
-    // 1.组装sql语句
-    char sql[1024] = "update user set state = 'offline' where state = 'online'";
+// 一条update语句最多更新的用户数，更多的用户分多条语句执行
+static const size_t kMaxRowsPerUpdate = 256;
+
+bool UserModel::updateState(
+    const std::vector<std::pair<int, long long>> &sessions,
+    const std::string &state) {
+    if (sessions.empty()) {
+        return true;
+    }
 
-    MySQL mysql;
-    if (mysql.connect()) {
-        mysql.update(sql);
+    std::shared_ptr<MySQL> mysql = ConnectionPool::instance()->getConnection();
+    if (!mysql) {
+        return false;
+    }
+
+    for (size_t begin = 0; begin < sessions.size();
+         begin += kMaxRowsPerUpdate) {
+        size_t count = std::min(kMaxRowsPerUpdate, sessions.size() - begin);
+        // 会话的行数向上取整到2的幂，多出的行重复最后一个会话
+        // 不同行数的批次共用少数几条预处理语句
+        size_t slots = 1;
+        while (slots < count) {
+            slots <<= 1;
+        }
+
+        // 会话作为派生表和user表连接，每个用户按自己的纪元判断是否更新
+        std::string sql = "update user join (select ? as id, ? as epoch";
+        for (size_t i = 1; i < slots; ++i) {
+            sql += " union all select ?, ?";
+        }
+        sql += ") s on user.id = s.id set user.state = ?, user.epoch = s.epoch "
+               "where user.epoch <= s.epoch";
+        MySQLStmt *stmt = mysql->prepare(sql);
+        if (stmt == nullptr) {
+            return false;
+        }
+        for (size_t i = 0; i < slots; ++i) {
+            const auto &session = sessions[begin + std::min(i, count - 1)];
+            stmt->setInt(2 * i, session.first);
+            stmt->setInt(2 * i + 1, session.second);
+        }
+        stmt->setString(2 * slots, state);
+        if (!stmt->execute()) {
+            return false;
+        }
     }
+    return true;
 }
@@ -0,0 +1,46 @@
+#include "offlinemsgwriter.hpp"
+
+#include <iterator>
+#include <muduo/base/Logging.h>
+
+// 缓冲的时间窗口(ms)
+static const int kFlushInterval = 50;
+// 缓冲的消息数达到该值时立即写入
+static const size_t kFlushThreshold = 1000;
+
+OfflineMsgWriter::OfflineMsgWriter()
+    : flusher_(kFlushInterval, [this]() { return write(); }) {}
+
+void OfflineMsgWriter::append(int userid, const std::string &msg) {
+    bool full = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.emplace_back(userid, msg);
+        full = pending_.size() >= kFlushThreshold;
+    }
+    flusher_.added(full);
+}
+
+bool OfflineMsgWriter::write() {
+    std::vector<std::pair<int, std::string>> msgVec;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        msgVec.swap(pending_);
+    }
+    if (msgVec.empty()) {
+        return true;
+    }
+
+    if (!offlineMsgModel_.insert(msgVec)) {
+        // 只有连接不可用时才会失败，写不进去的单条消息已经在insert中丢弃
+        // 失败的消息放回缓冲区头部，保持原来的顺序，下一个时间窗口重试
+        LOG_ERROR << "write " << msgVec.size()
+                  << " offline messages failed, retry later!";
+        std::lock_guard<std::mutex> lock(mutex_);
+        msgVec.insert(msgVec.end(), std::make_move_iterator(pending_.begin()),
+                      std::make_move_iterator(pending_.end()));
+        pending_.swap(msgVec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,128 @@
+#include "presencedirectory.hpp"
+
+constexpr double PresenceDirectory::kLeaseRenewInterval;
+constexpr std::chrono::milliseconds PresenceDirectory::kCacheTtl;
+constexpr std::chrono::milliseconds PresenceDirectory::kOfflineCacheTtl;
+
+PresenceDirectory::PresenceDirectory(Redis &redis) : redis_(redis) {}
+
+long long PresenceDirectory::claim(int userid, const std::string &node) {
+    long long epoch = redis_.claimUserNode(userid, node);
+    if (epoch > 0) {
+        updateCache(userid, node, Clock::now());
+    }
+    return epoch;
+}
+
+bool PresenceDirectory::release(int userid, const std::string &node,
+                                long long epoch) {
+    updateCache(userid, "", Clock::now());
+    return redis_.delUserNode(userid, node, epoch);
+}
+
+std::string PresenceDirectory::lookup(int userid) {
+    Clock::time_point now = Clock::now();
+    std::string node;
+    if (findCache(userid, now, node)) {
+        return node;
+    }
+
+    node = redis_.getUserNode(userid);
+    updateCache(userid, node, now);
+    return node;
+}
+
+std::vector<std::string>
+PresenceDirectory::lookup(const std::vector<int> &userids) {
+    Clock::time_point now = Clock::now();
+    std::vector<std::string> nodes(userids.size());
+
+    // 先查本地缓存，未命中的用户合并成一次HMGET
+    std::vector<int> missVec;
+    std::vector<size_t> missIndex;
+    for (size_t i = 0; i < userids.size(); ++i) {
+        if (!findCache(userids[i], now, nodes[i])) {
+            missVec.push_back(userids[i]);
+            missIndex.push_back(i);
+        }
+    }
+    if (missVec.empty()) {
+        return nodes;
+    }
+
+    std::vector<std::string> missNodes = redis_.getUserNodes(missVec);
+    for (size_t i = 0; i < missVec.size(); ++i) {
+        updateCache(missVec[i], missNodes[i], now);
+        nodes[missIndex[i]] = std::move(missNodes[i]);
+    }
+    return nodes;
+}
+
+bool PresenceDirectory::join(const std::string &node,
+                             std::vector<std::pair<int, long long>> &swept) {
+    if (!redis_.sweepUserNodes(node, swept)) {
+        return false;
+    }
+    Clock::time_point now = Clock::now();
+    for (const auto &session : swept) {
+        updateCache(session.first, "", now);
+    }
+    return redis_.renewLease(node, kLeaseTtlMs) >= 0;
+}
+
+bool PresenceDirectory::renewLease(const std::string &node) {
+    // redis暂时不可用时不能确定租约是否过期，等下一次续约再判断
+    return redis_.renewLease(node, kLeaseTtlMs) != 0;
+}
+
+void PresenceDirectory::restore(
+    const std::string &node,
+    const std::vector<std::pair<int, long long>> &sessions) {
+    redis_.restoreUserNodes(node, sessions);
+}
+
+std::vector<std::pair<int, long long>>
+PresenceDirectory::sweep(const std::string &node) {
+    std::vector<std::pair<int, long long>> sessions;
+    redis_.sweepUserNodes(node, sessions);
+    Clock::time_point now = Clock::now();
+    for (const auto &session : sessions) {
+        updateCache(session.first, "", now);
+    }
+    return sessions;
+}
+
+std::vector<std::pair<int, long long>>
+PresenceDirectory::sweepExpired(std::vector<std::string> &expiredNodes) {
+    std::vector<std::pair<int, long long>> sessions;
+    redis_.sweepExpiredNodes(sessions, expiredNodes);
+    Clock::time_point now = Clock::now();
+    for (const auto &session : sessions) {
+        updateCache(session.first, "", now);
+    }
+    return sessions;
+}
+
+bool PresenceDirectory::findCache(int userid, Clock::time_point now,
+                                  std::string &node) {
+    Shard &s = shard(userid);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.entries.find(userid);
+    if (it == s.entries.end()) {
+        return false;
+    }
+    if (it->second.expire <= now) {
+        s.entries.erase(it);
+        return false;
+    }
+    node = it->second.node;
+    return true;
+}
+
+void PresenceDirectory::updateCache(int userid, const std::string &node,
+                                    Clock::time_point now) {
+    Shard &s = shard(userid);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.entries[userid] =
+        CacheEntry{node, now + (node.empty() ? kOfflineCacheTtl : kCacheTtl)};
+}
@@ -1,134 +1,1027 @@
 #include "redis.hpp"
+#include "redisasyncadapter.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
 #include <iostream>
+#include <vector>
 using namespace std;
 
+// 重连的退避间隔（秒），从最小值开始每次失败翻倍，直到最大值
+static const double kMinRetryDelay = 0.1;
+static const double kMaxRetryDelay = 5.0;
+
+// 在线用户目录的命令上下文池的最大连接数
+static const int kMaxCommandContextNum = 8;
+
+// publish连接断开期间最多缓存的消息数，超过后丢弃最早的消息
+static const size_t kMaxPublishBacklog = 100000;
+
+// STREAM方式：每个节点的Stream只由本节点消费，消费组和消费者名固定，重启后可以接着处理未确认的消息
+static const char *kStreamGroup = "chatserver";
+static const char *kStreamConsumer = "consumer";
+static const char *kStreamField = "payload";
+// 每个Stream最多保留的消息数（近似裁剪）
+static const int kStreamMaxLen = 100000;
+// 一次XREADGROUP最多读取的消息数和阻塞等待时间，阻塞有上限是为了能及时读到新订阅的Stream
+static const int kStreamReadCount = 256;
+static const int kStreamBlockMs = 1000;
+// 过期节点的Stream延迟清理的时间，其它节点的在线用户目录缓存过期之前，仍可能向它追加消息
+static const chrono::seconds kStreamDrainDelay(3);
+
 Redis::Redis()
-    : _publish_context(nullptr), _subcribe_context(nullptr)
+    : _publish_context(nullptr), _loop_thread(EventLoopThread::ThreadInitCallback(), "RedisLoop"),
+      _loop(nullptr), _publish_connected(false), _publish_retry_delay(kMinRetryDelay),
+      _mode(PUBSUB), _subcribe_context(nullptr), _command_context_count(0), _command_retry_delay(kMinRetryDelay),
+      _stopping(false)
 {
 }
 
 Redis::~Redis()
 {
-    if (_publish_context != nullptr)
+    _stopping = true;
+
+    if (_loop != nullptr)
     {
-        redisFree(_publish_context);
+        // 异步上下文只能在事件循环线程中释放，等待释放完成后再退出事件循环
+        promise<void> done;
+        _loop->runInLoop([this, &done]() {
+            if (_publish_context != nullptr)
+            {
+                redisAsyncFree(_publish_context);
+                _publish_context = nullptr;
+            }
+            done.set_value();
+        });
+        done.get_future().wait();
     }
 
     if (_subcribe_context != nullptr)
     {
         redisFree(_subcribe_context);
     }
+
+    for (redisContext *context : _command_contexts)
+    {
+        redisFree(context);
+    }
 }
 
-bool Redis::connect()
+void Redis::setDeliveryMode(DeliveryMode mode)
+{
+    _mode = mode;
+}
+
+redisContext *Redis::connectContext()
 {
-    // 负责publish发布消息的上下文连接
-    _publish_context = redisConnect("127.0.0.1", 6379);
-    if (nullptr == _publish_context)
+    redisContext *context = redisConnect("127.0.0.1", 6379);
+    if (nullptr == context || context->err)
     {
-        cerr << "connect redis failed!" << endl;
-        return false;
+        cerr << "connect redis failed! " << (context != nullptr ? context->errstr : "") << endl;
+        if (context != nullptr)
+        {
+            redisFree(context);
+        }
+        return nullptr;
     }
 
-    // 负责subscribe订阅消息的上下文连接
-    _subcribe_context = redisConnect("127.0.0.1", 6379);
-    if (nullptr == _subcribe_context)
+    // 打开TCP保活，对端掉线时阻塞在读上的订阅线程也能感知到连接断开
+    redisEnableKeepAlive(context);
+    return context;
+}
+
+bool Redis::connect()
+{
+    // 负责在线用户目录读写的上下文连接，连接失败时在下一次使用时按退避间隔重连
+    bool connected = false;
     {
-        cerr << "connect redis failed!" << endl;
-        return false;
+        CommandContext command(*this);
+        connected = command.get() != nullptr;
     }
 
+    // 负责publish发布消息的异步上下文连接，在独立的事件循环线程中收发，不阻塞调用publish的线程
+    _loop = _loop_thread.startLoop();
+    _loop->runInLoop(std::bind(&Redis::connectPublishContext, this));
+
     // 在单独的线程中，监听通道上的事件，有消息给业务层进行上报
+    // 订阅连接由观察线程建立，redis暂时不可用时按退避间隔重连，连接成功后恢复全部订阅
     thread t([&]() {
-        observer_channel_message();
+        if (STREAM == _mode)
+        {
+            observer_stream_message();
+        }
+        else
+        {
+            observer_channel_message();
+        }
     });
     t.detach();
 
-    cout << "connect redis-server success!" << endl;
+    if (connected)
+    {
+        cout << "connect redis-server success!" << endl;
+    }
+    return connected;
+}
 
-    return true;
+void Redis::connectPublishContext()
+{
+    if (_stopping)
+    {
+        return;
+    }
+
+    _publish_context = redisAsyncConnect("127.0.0.1", 6379);
+    if (nullptr == _publish_context || _publish_context->err)
+    {
+        cerr << "connect redis failed!" << endl;
+        if (_publish_context != nullptr)
+        {
+            redisAsyncFree(_publish_context);
+            _publish_context = nullptr;
+        }
+        schedulePublishReconnect();
+        return;
+    }
+
+    _publish_context->data = this;
+    // 先绑定事件循环，设置连接回调时hiredis会注册写事件来检测连接是否建立
+    RedisAsyncAdapter::attach(_loop, _publish_context);
+    redisAsyncSetConnectCallback(_publish_context, Redis::onPublishConnect);
+    redisAsyncSetDisconnectCallback(_publish_context, Redis::onPublishDisconnect);
+}
+
+void Redis::schedulePublishReconnect()
+{
+    if (_stopping)
+    {
+        return;
+    }
+
+    cerr << "reconnect redis publish context after " << _publish_retry_delay << "s" << endl;
+    _loop->runAfter(_publish_retry_delay, std::bind(&Redis::connectPublishContext, this));
+    _publish_retry_delay = min(_publish_retry_delay * 2, kMaxRetryDelay);
+}
+
+void Redis::onPublishConnect(const redisAsyncContext *context, int status)
+{
+    Redis *redis = static_cast<Redis *>(context->data);
+    if (REDIS_OK != status)
+    {
+        // 连接失败时hiredis会释放上下文
+        cerr << "connect redis failed!" << endl;
+        redis->_publish_context = nullptr;
+        redis->schedulePublishReconnect();
+        return;
+    }
+
+    // 连接建立后补发断开期间缓存的消息
+    redis->_publish_connected = true;
+    redis->_publish_retry_delay = kMinRetryDelay;
+    redis->flushPublishQueue();
+}
+
+void Redis::onPublishDisconnect(const redisAsyncContext *context, int status)
+{
+    Redis *redis = static_cast<Redis *>(context->data);
+    redis->_publish_context = nullptr;
+    redis->_publish_connected = false;
+
+    // REDIS_OK表示主动释放上下文，只有异常断开才需要重连
+    if (REDIS_OK != status)
+    {
+        cerr << "redis publish connection closed!" << endl;
+        redis->schedulePublishReconnect();
+    }
+}
+
+void Redis::onPublishReply(redisAsyncContext *context, void *reply, void *privdata)
+{
+    redisReply *r = static_cast<redisReply *>(reply);
+    if (nullptr == r || REDIS_REPLY_ERROR == r->type)
+    {
+        cerr << "publish command failed!" << endl;
+    }
 }
 
 // 向redis指定的通道channel发布消息
-bool Redis::publish(int channel, string message)
+bool Redis::publish(const string &channel, const string &message)
 {
-    redisReply *reply = (redisReply *)redisCommand(_publish_context, "PUBLISH %d %s", channel, message.c_str());
-    if (nullptr == reply)
+    if (nullptr == _loop)
     {
         cerr << "publish command failed!" << endl;
         return false;
     }
-    freeReplyObject(reply);
+
+    // hiredis上下文不是线程安全的，PUBLISH命令统一在redis事件循环线程中发出
+    // 消息先放入无锁队列，只有队列由空变为非空时才唤醒事件循环，一次唤醒处理一批消息
+    if (_publish_queue.push(make_pair(channel, message)))
+    {
+        _loop->queueInLoop(std::bind(&Redis::flushPublishQueue, this));
+    }
     return true;
 }
 
-// 向redis指定的通道subscribe订阅消息
-bool Redis::subscribe(int channel)
+void Redis::flushPublishQueue()
 {
-    // SUBSCRIBE命令本身会造成线程阻塞等待通道里面发生消息，这里只做订阅通道，不接收通道消息
-    // 通道消息的接收专门在observer_channel_message函数中的独立线程中进行
+    vector<pair<string, string>> messages;
+    _publish_queue.popAll(messages);
+    for (pair<string, string> &msg : messages)
+    {
+        _publish_backlog.push_back(std::move(msg));
+    }
+
+    // 连接断开期间消息留在缓存中，等待重连成功后补发
+    if (!_publish_connected)
+    {
+        if (_publish_backlog.size() > kMaxPublishBacklog)
+        {
+            cerr << "publish backlog full, drop " << _publish_backlog.size() - kMaxPublishBacklog
+                 << " messages!" << endl;
+            _publish_backlog.erase(_publish_backlog.begin(),
+                                   _publish_backlog.end() - kMaxPublishBacklog);
+        }
+        return;
+    }
+
+    // 异步发送不等待响应，这一批命令先追加到输出缓冲区，在连接可写时合并写出
+    while (!_publish_backlog.empty())
+    {
+        const pair<string, string> &msg = _publish_backlog.front();
+        int ret = STREAM == _mode
+                      ? redisAsyncCommand(_publish_context, Redis::onPublishReply, nullptr,
+                                          "XADD %s MAXLEN ~ %d * %s %b", msg.first.c_str(),
+                                          kStreamMaxLen, kStreamField,
+                                          msg.second.data(), msg.second.size())
+                      : redisAsyncCommand(_publish_context, Redis::onPublishReply, nullptr,
+                                          "PUBLISH %s %b", msg.first.c_str(),
+                                          msg.second.data(), msg.second.size());
+        if (REDIS_ERR == ret)
+        {
+            cerr << "publish command failed!" << endl;
+        }
+        _publish_backlog.pop_front();
+    }
+}
+
+bool Redis::writeSubscribeCommand(redisContext *context, const vector<string> &args)
+{
+    vector<const char *> argv;
+    vector<size_t> argvlen;
+    for (const string &arg : args)
+    {
+        argv.push_back(arg.data());
+        argvlen.push_back(arg.size());
+    }
+
     // 只负责发送命令，不阻塞接收redis server响应消息，否则和notifyMsg线程抢占响应资源
-    if (REDIS_ERR == redisAppendCommand(this->_subcribe_context, "SUBSCRIBE %d", channel))
+    if (REDIS_ERR == redisAppendCommandArgv(context, argv.size(), argv.data(), argvlen.data()))
     {
-        cerr << "subscribe command failed!" << endl;
         return false;
     }
     // redisBufferWrite可以循环发送缓冲区，直到缓冲区数据发送完毕（done被置为1）
     int done = 0;
     while (!done)
     {
-        if (REDIS_ERR == redisBufferWrite(this->_subcribe_context, &done))
+        if (REDIS_ERR == redisBufferWrite(context, &done))
         {
-            cerr << "subscribe command failed!" << endl;
             return false;
         }
     }
-    // redisGetReply
+    return true;
+}
 
+// 向redis指定的通道subscribe订阅消息
+bool Redis::subscribe(const string &channel)
+{
+    // SUBSCRIBE命令本身会造成线程阻塞等待通道里面发生消息，这里只做订阅通道，不接收通道消息
+    // 通道消息的接收专门在observer_channel_message函数中的独立线程中进行
+    // 先记录通道，即使此时连接已断开，重连后也会恢复订阅
+    lock_guard<mutex> lock(_subscribe_mutex);
+    _channels.insert(channel);
+    if (STREAM == _mode)
+    {
+        // 读取线程每次读取前取一次通道列表，这里只需要保证消费组存在
+        // 创建失败时读取会出错，观察线程重连时为所有通道重建消费组
+        CommandContext command(*this);
+        redisContext *context = command.get();
+        if (nullptr == context || !createStreamGroup(context, channel))
+        {
+            cerr << "xgroup command failed, retry after reconnect!" << endl;
+        }
+        return true;
+    }
+    // 订阅连接还没有建立或者已经断开时，观察线程重连后会恢复订阅
+    if (nullptr != _subcribe_context &&
+        !writeSubscribeCommand(_subcribe_context, {"SUBSCRIBE", channel}))
+    {
+        cerr << "subscribe command failed, resubscribe after reconnect!" << endl;
+    }
     return true;
 }
 
 // 向redis指定的通道unsubscribe取消订阅消息
-bool Redis::unsubscribe(int channel)
+bool Redis::unsubscribe(const string &channel)
 {
-    if (REDIS_ERR == redisAppendCommand(this->_subcribe_context, "UNSUBSCRIBE %d", channel))
+    lock_guard<mutex> lock(_subscribe_mutex);
+    _channels.erase(channel);
+    if (STREAM == _mode)
+    {
+        return true;
+    }
+    // 订阅连接重连时只恢复_channels中的通道
+    if (nullptr != _subcribe_context &&
+        !writeSubscribeCommand(_subcribe_context, {"UNSUBSCRIBE", channel}))
     {
         cerr << "unsubscribe command failed!" << endl;
+    }
+    return true;
+}
+
+bool Redis::reconnectSubscribeContext()
+{
+    redisContext *context = connectContext();
+    if (nullptr == context)
+    {
         return false;
     }
-    // redisBufferWrite可以循环发送缓冲区，直到缓冲区数据发送完毕（done被置为1）
-    int done = 0;
-    while (!done)
+
+    lock_guard<mutex> lock(_subscribe_mutex);
+    if (STREAM == _mode)
+    {
+        // Stream可能随redis数据一起丢失，重建消费组，已存在时不影响未确认的消息
+        for (const string &channel : _channels)
+        {
+            if (!createStreamGroup(context, channel))
+            {
+                redisFree(context);
+                return false;
+            }
+        }
+    }
+    // 所有通道放在一条SUBSCRIBE命令中一次性恢复订阅
+    else if (!_channels.empty())
     {
-        if (REDIS_ERR == redisBufferWrite(this->_subcribe_context, &done))
+        vector<string> args;
+        args.reserve(_channels.size() + 1);
+        args.push_back("SUBSCRIBE");
+        args.insert(args.end(), _channels.begin(), _channels.end());
+        if (!writeSubscribeCommand(context, args))
         {
-            cerr << "unsubscribe command failed!" << endl;
+            cerr << "subscribe command failed!" << endl;
+            redisFree(context);
             return false;
         }
     }
+
+    if (nullptr != _subcribe_context)
+    {
+        redisFree(_subcribe_context);
+    }
+    _subcribe_context = context;
     return true;
 }
 
+void Redis::waitSubscribeContext()
+{
+    double delay = kMinRetryDelay;
+    while (!_stopping && !reconnectSubscribeContext())
+    {
+        cerr << "reconnect redis subscribe context after " << delay << "s" << endl;
+        this_thread::sleep_for(chrono::duration<double>(delay));
+        delay = min(delay * 2, kMaxRetryDelay);
+    }
+}
+
+bool Redis::createStreamGroup(redisContext *context, const string &stream)
+{
+    // MKSTREAM在Stream不存在时创建空Stream，从头开始消费，不丢失消费组创建前写入的消息
+    redisReply *reply = (redisReply *)redisCommand(context, "XGROUP CREATE %s %s 0 MKSTREAM",
+                                                   stream.c_str(), kStreamGroup);
+    if (nullptr == reply)
+    {
+        cerr << "xgroup command failed!" << endl;
+        return false;
+    }
+
+    // 消费组已经存在时返回BUSYGROUP错误，沿用原来的消费进度
+    bool ok = REDIS_REPLY_ERROR != reply->type || 0 == strncmp(reply->str, "BUSYGROUP", 9);
+    if (!ok)
+    {
+        cerr << "xgroup command failed! " << reply->str << endl;
+    }
+    freeReplyObject(reply);
+    return ok;
+}
+
+redisContext *Redis::acquireCommandContext()
+{
+    unique_lock<mutex> lock(_command_mutex);
+    while (_command_contexts.empty() && _command_context_count >= kMaxCommandContextNum)
+    {
+        _command_cv.wait(lock);
+    }
+    if (!_command_contexts.empty())
+    {
+        redisContext *context = _command_contexts.back();
+        _command_contexts.pop_back();
+        return context;
+    }
+
+    // 没有空闲的上下文，还没到上限时新建一个，到了重试时间才重新连接
+    if (chrono::steady_clock::now() < _command_retry_time)
+    {
+        return nullptr;
+    }
+    ++_command_context_count;
+    lock.unlock();
+    redisContext *context = connectContext();
+    lock.lock();
+    if (nullptr == context)
+    {
+        --_command_context_count;
+        _command_retry_time = chrono::steady_clock::now() +
+                              chrono::duration_cast<chrono::steady_clock::duration>(
+                                  chrono::duration<double>(_command_retry_delay));
+        _command_retry_delay = min(_command_retry_delay * 2, kMaxRetryDelay);
+        _command_cv.notify_one();
+        return nullptr;
+    }
+    _command_retry_delay = kMinRetryDelay;
+    return context;
+}
+
+void Redis::releaseCommandContext(redisContext *context)
+{
+    // hiredis同步上下文出错后不可再用
+    if (context->err)
+    {
+        redisFree(context);
+        lock_guard<mutex> lock(_command_mutex);
+        --_command_context_count;
+    }
+    else
+    {
+        lock_guard<mutex> lock(_command_mutex);
+        _command_contexts.push_back(context);
+    }
+    _command_cv.notify_one();
+}
+
+// 在线用户目录，hash结构 userid -> "服务器节点 会话纪元"
+static const char *kPresenceKey = "chat:presence";
+// 全局递增的会话纪元，每次登录分配一个，区分同一用户先后的多次登录
+static const char *kEpochKey = "chat:presence:epoch";
+// 所有登记过用户的服务器节点集合
+static const char *kNodesKey = "chat:presence:nodes";
+// 节点租约，带过期时间的字符串，节点存活期间定时续约
+static const string kLeaseKeyPrefix = "chat:presence:lease:";
+// 每个节点上登录的用户集合，节点租约过期后据此批量清理目录
+static const string kNodeUsersKeyPrefix = "chat:presence:users:";
+
+// 用户不在线时分配会话纪元并登记，已经在线返回0，保证判断和登记是原子的，集群中同一用户只能登录一次
+static const char *kClaimUserNodeScript =
+    "if redis.call('HEXISTS', KEYS[1], ARGV[1]) == 1 then return 0 end "
+    "local epoch = redis.call('INCR', KEYS[2]) "
+    "redis.call('HSET', KEYS[1], ARGV[1], ARGV[2] .. ' ' .. epoch) "
+    "redis.call('SADD', KEYS[3], ARGV[1]) "
+    "return epoch";
+
+// 只有记录的仍然是调用者的这次会话时才删除，保证判断和删除是原子的
+static const char *kDelUserNodeScript =
+    "if redis.call('HGET', KEYS[1], ARGV[1]) == ARGV[2] then "
+    "redis.call('SREM', KEYS[2], ARGV[1]) "
+    "return redis.call('HDEL', KEYS[1], ARGV[1]) end return 0";
+
+// 续约节点租约，租约已经过期时重新取得租约并返回0
+static const char *kRenewLeaseScript =
+    "if redis.call('SET', KEYS[1], '1', 'PX', ARGV[2], 'XX') then return 1 end "
+    "redis.call('SET', KEYS[1], '1', 'PX', ARGV[2]) "
+    "redis.call('SADD', KEYS[2], ARGV[1]) "
+    "return 0";
+
+// 重新登记节点上仍然在线的用户，用户已经在其它节点登录时不覆盖
+static const char *kRestoreUserNodesScript =
+    "for i = 2, #ARGV, 2 do "
+    "local value = ARGV[1] .. ' ' .. ARGV[i + 1] "
+    "redis.call('HSETNX', KEYS[1], ARGV[i], value) "
+    "if redis.call('HGET', KEYS[1], ARGV[i]) == value then redis.call('SADD', KEYS[2], ARGV[i]) end "
+    "end return 1";
+
+// 清理ARGV[3]指定的节点上登记的用户并删除它的租约，返回被清理的{userid, 会话纪元, ...}
+// 节点仍然留在节点集合中，租约不存在，之后由存活节点按过期节点处理（STREAM方式下清理它的Stream）
+// 节点的用户集合和租约的key在脚本中拼出，只适用于单实例redis
+static const char *kSweepUserNodesScript =
+    "local swept = {} "
+    "local node = ARGV[3] "
+    "local users = ARGV[2] .. node "
+    "for _, uid in ipairs(redis.call('SMEMBERS', users)) do "
+    "local value = redis.call('HGET', KEYS[1], uid) "
+    "if value and string.sub(value, 1, #node + 1) == node .. ' ' then "
+    "redis.call('HDEL', KEYS[1], uid) "
+    "table.insert(swept, uid) table.insert(swept, string.sub(value, #node + 2)) end "
+    "end "
+    "redis.call('DEL', users, ARGV[1] .. node) "
+    "return swept";
+
+// 清理租约过期的节点上登记的用户，并把节点移出节点集合，返回{被清理的{userid, 会话纪元, ...}, 被清理的节点}
+static const char *kSweepExpiredNodesScript =
+    "local swept = {} local expired = {} "
+    "for _, node in ipairs(redis.call('SMEMBERS', KEYS[2])) do "
+    "if redis.call('EXISTS', ARGV[1] .. node) == 0 then "
+    "local users = ARGV[2] .. node "
+    "for _, uid in ipairs(redis.call('SMEMBERS', users)) do "
+    "local value = redis.call('HGET', KEYS[1], uid) "
+    "if value and string.sub(value, 1, #node + 1) == node .. ' ' then "
+    "redis.call('HDEL', KEYS[1], uid) "
+    "table.insert(swept, uid) table.insert(swept, string.sub(value, #node + 2)) end "
+    "end "
+    "redis.call('DEL', users) "
+    "redis.call('SREM', KEYS[2], node) "
+    "table.insert(expired, node) "
+    "end end return {swept, expired}";
+
+// 目录记录的格式是"节点 纪元"，节点id本身可以包含':'，以最后一个空格分隔
+static string presenceValue(const string &node, long long epoch)
+{
+    return node + ' ' + to_string(epoch);
+}
+
+static string presenceNode(const redisReply *reply)
+{
+    if (REDIS_REPLY_STRING != reply->type)
+    {
+        return "";
+    }
+    string value(reply->str, reply->len);
+    size_t pos = value.rfind(' ');
+    return pos == string::npos ? value : value.substr(0, pos);
+}
+
+long long Redis::claimUserNode(int userid, const string &node)
+{
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommand(context, "EVAL %s 3 %s %s %s %d %s",
+                                           kClaimUserNodeScript, kPresenceKey, kEpochKey,
+                                           (kNodeUsersKeyPrefix + node).c_str(), userid, node.c_str());
+    }
+    if (nullptr == reply)
+    {
+        cerr << "eval command failed!" << endl;
+        return -1;
+    }
+
+    long long epoch = REDIS_REPLY_INTEGER == reply->type ? reply->integer : -1;
+    freeReplyObject(reply);
+    return epoch;
+}
+
+bool Redis::delUserNode(int userid, const string &node, long long epoch)
+{
+    string value = presenceValue(node, epoch);
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommand(context, "EVAL %s 2 %s %s %d %s",
+                                           kDelUserNodeScript, kPresenceKey,
+                                           (kNodeUsersKeyPrefix + node).c_str(), userid, value.c_str());
+    }
+    if (nullptr == reply)
+    {
+        cerr << "eval command failed!" << endl;
+        return false;
+    }
+    freeReplyObject(reply);
+    return true;
+}
+
+string Redis::getUserNode(int userid)
+{
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommand(context, "HGET %s %d", kPresenceKey, userid);
+    }
+    if (nullptr == reply)
+    {
+        cerr << "hget command failed!" << endl;
+        return "";
+    }
+
+    string node = presenceNode(reply);
+    freeReplyObject(reply);
+    return node;
+}
+
+vector<string> Redis::getUserNodes(const vector<int> &userids)
+{
+    vector<string> nodes(userids.size());
+    if (userids.empty())
+    {
+        return nodes;
+    }
+
+    // HMGET key field1 field2 ... 一次查询所有用户
+    vector<string> args;
+    args.reserve(userids.size() + 2);
+    args.push_back("HMGET");
+    args.push_back(kPresenceKey);
+    for (int userid : userids)
+    {
+        args.push_back(to_string(userid));
+    }
+    vector<const char *> argv;
+    vector<size_t> argvlen;
+    for (const string &arg : args)
+    {
+        argv.push_back(arg.data());
+        argvlen.push_back(arg.size());
+    }
+
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommandArgv(context, argv.size(), argv.data(), argvlen.data());
+    }
+    if (nullptr == reply)
+    {
+        cerr << "hmget command failed!" << endl;
+        return nodes;
+    }
+
+    if (REDIS_REPLY_ARRAY == reply->type && reply->elements == userids.size())
+    {
+        for (size_t i = 0; i < reply->elements; ++i)
+        {
+            nodes[i] = presenceNode(reply->element[i]);
+        }
+    }
+    freeReplyObject(reply);
+    return nodes;
+}
+
+int Redis::renewLease(const string &node, int ttlms)
+{
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommand(context, "EVAL %s 2 %s %s %s %d",
+                                           kRenewLeaseScript, (kLeaseKeyPrefix + node).c_str(),
+                                           kNodesKey, node.c_str(), ttlms);
+    }
+    if (nullptr == reply)
+    {
+        cerr << "eval command failed!" << endl;
+        return -1;
+    }
+
+    int renewed = REDIS_REPLY_INTEGER == reply->type ? static_cast<int>(reply->integer) : -1;
+    freeReplyObject(reply);
+    return renewed;
+}
+
+bool Redis::restoreUserNodes(const string &node, const vector<pair<int, long long>> &sessions)
+{
+    if (sessions.empty())
+    {
+        return true;
+    }
+
+    // EVAL script 2 presence users node uid1 epoch1 uid2 epoch2 ...
+    vector<string> args = {"EVAL", kRestoreUserNodesScript, "2", kPresenceKey,
+                           kNodeUsersKeyPrefix + node, node};
+    for (const pair<int, long long> &session : sessions)
+    {
+        args.push_back(to_string(session.first));
+        args.push_back(to_string(session.second));
+    }
+    vector<const char *> argv;
+    vector<size_t> argvlen;
+    for (const string &arg : args)
+    {
+        argv.push_back(arg.data());
+        argvlen.push_back(arg.size());
+    }
+
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommandArgv(context, argv.size(), argv.data(), argvlen.data());
+    }
+    if (nullptr == reply)
+    {
+        cerr << "eval command failed!" << endl;
+        return false;
+    }
+    freeReplyObject(reply);
+    return true;
+}
+
+// 把清理脚本返回的{userid, 会话纪元, ...}放入sessions
+static void appendSessions(const redisReply *reply, vector<pair<int, long long>> &sessions)
+{
+    for (size_t i = 0; i + 1 < reply->elements; i += 2)
+    {
+        sessions.emplace_back(atoi(reply->element[i]->str), atoll(reply->element[i + 1]->str));
+    }
+}
+
+bool Redis::sweepUserNodes(const string &node, vector<pair<int, long long>> &sessions)
+{
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommand(context, "EVAL %s 1 %s %s %s %s",
+                                           kSweepUserNodesScript, kPresenceKey,
+                                           kLeaseKeyPrefix.c_str(), kNodeUsersKeyPrefix.c_str(), node.c_str());
+    }
+    if (nullptr == reply)
+    {
+        cerr << "eval command failed!" << endl;
+        return false;
+    }
+
+    bool ok = REDIS_REPLY_ARRAY == reply->type;
+    if (ok)
+    {
+        appendSessions(reply, sessions);
+    }
+    freeReplyObject(reply);
+    return ok;
+}
+
+bool Redis::sweepExpiredNodes(vector<pair<int, long long>> &sessions, vector<string> &nodes)
+{
+    CommandContext command(*this);
+    redisContext *context = command.get();
+    redisReply *reply = nullptr;
+    if (context != nullptr)
+    {
+        reply = (redisReply *)redisCommand(context, "EVAL %s 2 %s %s %s %s",
+                                           kSweepExpiredNodesScript, kPresenceKey, kNodesKey,
+                                           kLeaseKeyPrefix.c_str(), kNodeUsersKeyPrefix.c_str());
+    }
+    if (nullptr == reply)
+    {
+        cerr << "eval command failed!" << endl;
+        return false;
+    }
+
+    bool ok = REDIS_REPLY_ARRAY == reply->type && 2 == reply->elements;
+    if (ok)
+    {
+        appendSessions(reply->element[0], sessions);
+        redisReply *expired = reply->element[1];
+        for (size_t i = 0; i < expired->elements; ++i)
+        {
+            nodes.push_back(string(expired->element[i]->str, expired->element[i]->len));
+        }
+    }
+    freeReplyObject(reply);
+    return ok;
+}
+
 // 在独立线程中接收订阅通道中的消息
 void Redis::observer_channel_message()
 {
-    redisReply *reply = nullptr;
-    while (REDIS_OK == redisGetReply(this->_subcribe_context, (void **)&reply))
+    while (!_stopping)
     {
-        // 订阅收到的消息是一个带三元素的数组
-        if (reply != nullptr && reply->element[2] != nullptr && reply->element[2]->str != nullptr)
+        // 建立订阅连接（启动时redis不可用或者连接断开），按退避间隔重连并恢复全部订阅
+        waitSubscribeContext();
+        if (_stopping)
         {
-            // 给业务层上报通道上发生的消息
-            _notify_message_handler(atoi(reply->element[1]->str) , reply->element[2]->str);
+            break;
         }
 
-        freeReplyObject(reply);
+        // _subcribe_context只会在本线程中被替换，读取时不需要加锁
+        redisReply *reply = nullptr;
+        while (REDIS_OK == redisGetReply(this->_subcribe_context, (void **)&reply))
+        {
+            // 订阅收到的消息是一个带三元素的数组
+            if (reply != nullptr && reply->element[2] != nullptr && reply->element[2]->str != nullptr)
+            {
+                // 给业务层上报通道上发生的消息，按长度构造，消息内容可以包含任意字节
+                _notify_message_handler(string(reply->element[2]->str, reply->element[2]->len));
+            }
+
+            freeReplyObject(reply);
+        }
+        cerr << "redis subscribe connection closed!" << endl;
     }
 
     cerr << ">>>>>>>>>>>>> observer_channel_message quit <<<<<<<<<<<<<" << endl;
 }
 
-void Redis::init_notify_handler(function<void(int,string)> fn)
+vector<string> Redis::subscribedStreams()
+{
+    lock_guard<mutex> lock(_subscribe_mutex);
+    return vector<string>(_channels.begin(), _channels.end());
+}
+
+int Redis::readStreamBatch(const vector<string> &streams, const string &startid, int blockms)
+{
+    if (streams.empty())
+    {
+        this_thread::sleep_for(chrono::milliseconds(blockms));
+        return 0;
+    }
+
+    // XREADGROUP GROUP group consumer COUNT n [BLOCK ms] STREAMS s1 s2 ... id1 id2 ...
+    vector<string> args = {"XREADGROUP", "GROUP", kStreamGroup, kStreamConsumer,
+                           "COUNT", to_string(kStreamReadCount)};
+    if (blockms > 0)
+    {
+        args.push_back("BLOCK");
+        args.push_back(to_string(blockms));
+    }
+    args.push_back("STREAMS");
+    args.insert(args.end(), streams.begin(), streams.end());
+    args.insert(args.end(), streams.size(), startid);
+
+    vector<const char *> argv;
+    vector<size_t> argvlen;
+    for (const string &arg : args)
+    {
+        argv.push_back(arg.data());
+        argvlen.push_back(arg.size());
+    }
+
+    redisReply *reply = (redisReply *)redisCommandArgv(_subcribe_context, argv.size(), argv.data(), argvlen.data());
+    if (nullptr == reply || REDIS_REPLY_ERROR == reply->type)
+    {
+        cerr << "xreadgroup command failed! " << (reply != nullptr ? reply->str : "") << endl;
+        if (reply != nullptr)
+        {
+            freeReplyObject(reply);
+        }
+        return -1;
+    }
+
+    // 阻塞超时没有新消息时返回nil，否则是[[stream, [[id, [field, value, ...]], ...]], ...]
+    int count = 0;
+    vector<vector<string>> acks;
+    if (REDIS_REPLY_ARRAY == reply->type)
+    {
+        for (size_t i = 0; i < reply->elements; ++i)
+        {
+            redisReply *stream = reply->element[i];
+            redisReply *entries = stream->element[1];
+            vector<string> ack = {"XACK", string(stream->element[0]->str, stream->element[0]->len), kStreamGroup};
+            for (size_t j = 0; j < entries->elements; ++j)
+            {
+                redisReply *entry = entries->element[j];
+                redisReply *fields = entry->element[1];
+                // 未确认的消息被MAXLEN裁剪后字段为nil，只需要确认掉
+                if (REDIS_REPLY_ARRAY == fields->type && fields->elements >= 2)
+                {
+                    // 给业务层上报Stream中的消息，按长度构造，消息内容可以包含任意字节
+                    _notify_message_handler(string(fields->element[1]->str, fields->element[1]->len));
+                }
+                ack.push_back(string(entry->element[0]->str, entry->element[0]->len));
+                ++count;
+            }
+            if (ack.size() > 3)
+            {
+                acks.push_back(std::move(ack));
+            }
+        }
+    }
+    freeReplyObject(reply);
+
+    // 消息已经交给业务层，每个Stream一条XACK，所有XACK流水线发送后再统一读取响应
+    for (const vector<string> &ack : acks)
+    {
+        argv.clear();
+        argvlen.clear();
+        for (const string &arg : ack)
+        {
+            argv.push_back(arg.data());
+            argvlen.push_back(arg.size());
+        }
+        if (REDIS_ERR == redisAppendCommandArgv(_subcribe_context, argv.size(), argv.data(), argvlen.data()))
+        {
+            cerr << "xack command failed!" << endl;
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < acks.size(); ++i)
+    {
+        if (REDIS_OK != redisGetReply(_subcribe_context, (void **)&reply))
+        {
+            cerr << "xack command failed!" << endl;
+            return -1;
+        }
+        freeReplyObject(reply);
+    }
+    return count;
+}
+
+void Redis::drainStream(const string &stream)
+{
+    if (STREAM != _mode)
+    {
+        return;
+    }
+
+    lock_guard<mutex> lock(_subscribe_mutex);
+    _drain_streams.emplace(stream, chrono::steady_clock::now() + kStreamDrainDelay);
+}
+
+bool Redis::drainStreams()
+{
+    vector<string> streams;
+    {
+        lock_guard<mutex> lock(_subscribe_mutex);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        for (const auto &entry : _drain_streams)
+        {
+            if (entry.second <= now)
+            {
+                streams.push_back(entry.first);
+            }
+        }
+    }
+
+    for (const string &stream : streams)
+    {
+        // 所有节点的消费者名相同，过期节点已读取未确认的消息就是本消费者在该Stream上的未确认消息
+        // 不需要XAUTOCLAIM转移，先读未确认的，再读还没有投递的，都交给业务层后删除整个Stream
+        if (!createStreamGroup(_subcribe_context, stream))
+        {
+            return false;
+        }
+        int count = 0;
+        while ((count = readStreamBatch({stream}, "0", 0)) > 0)
+        {
+        }
+        while (count == 0 && (count = readStreamBatch({stream}, ">", 0)) > 0)
+        {
+        }
+        if (count < 0)
+        {
+            return false;
+        }
+
+        redisReply *reply = (redisReply *)redisCommand(_subcribe_context, "DEL %s", stream.c_str());
+        if (nullptr == reply)
+        {
+            cerr << "del command failed!" << endl;
+            return false;
+        }
+        freeReplyObject(reply);
+
+        lock_guard<mutex> lock(_subscribe_mutex);
+        _drain_streams.erase(stream);
+    }
+    return true;
+}
+
+// STREAM方式下在独立线程中批量读取并确认订阅的Stream中的消息
+void Redis::observer_stream_message()
+{
+    while (!_stopping)
+    {
+        // 建立读取连接（启动时redis不可用或者连接出错），按退避间隔重连并重建消费组
+        waitSubscribeContext();
+        if (_stopping)
+        {
+            break;
+        }
+
+        // 先把上次连接中已读取但没有确认的消息重新投递一遍，再阻塞读取新消息
+        // 每次阻塞读取之前，先清理等待处理的过期节点的Stream
+        int count = 0;
+        while ((count = readStreamBatch(subscribedStreams(), "0", 0)) > 0)
+        {
+        }
+        while (count >= 0 && !_stopping)
+        {
+            count = drainStreams() ? readStreamBatch(subscribedStreams(), ">", kStreamBlockMs) : -1;
+        }
+        cerr << "redis stream connection failed!" << endl;
+    }
+
+    cerr << ">>>>>>>>>>>>> observer_stream_message quit <<<<<<<<<<<<<" << endl;
+}
+
+void Redis::init_notify_handler(function<void(const string &)> fn)
 {
     this->_notify_message_handler = fn;
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "redisasyncadapter.hpp"
+
+bool RedisAsyncAdapter::attach(EventLoop *loop, redisAsyncContext *context)
+{
+    // 已经绑定过事件库
+    if (context->ev.data != nullptr)
+    {
+        return false;
+    }
+
+    RedisAsyncAdapter *adapter = new RedisAsyncAdapter(loop, context);
+    context->ev.data = adapter;
+    context->ev.addRead = RedisAsyncAdapter::addRead;
+    context->ev.delRead = RedisAsyncAdapter::delRead;
+    context->ev.addWrite = RedisAsyncAdapter::addWrite;
+    context->ev.delWrite = RedisAsyncAdapter::delWrite;
+    context->ev.cleanup = RedisAsyncAdapter::cleanup;
+    return true;
+}
+
+RedisAsyncAdapter::RedisAsyncAdapter(EventLoop *loop, redisAsyncContext *context)
+    : _loop(loop), _context(context), _channel(new Channel(loop, context->c.fd))
+{
+    _channel->setReadCallback(std::bind(&RedisAsyncAdapter::handleRead, this, std::placeholders::_1));
+    _channel->setWriteCallback(std::bind(&RedisAsyncAdapter::handleWrite, this));
+}
+
+// hiredis每追加一条命令都会调用一次addWrite，事件没有变化时不再调用epoll_ctl
+void RedisAsyncAdapter::addRead(void *privdata)
+{
+    Channel *channel = static_cast<RedisAsyncAdapter *>(privdata)->_channel.get();
+    if (!channel->isReading())
+    {
+        channel->enableReading();
+    }
+}
+
+void RedisAsyncAdapter::delRead(void *privdata)
+{
+    Channel *channel = static_cast<RedisAsyncAdapter *>(privdata)->_channel.get();
+    if (channel->isReading())
+    {
+        channel->disableReading();
+    }
+}
+
+void RedisAsyncAdapter::addWrite(void *privdata)
+{
+    Channel *channel = static_cast<RedisAsyncAdapter *>(privdata)->_channel.get();
+    if (!channel->isWriting())
+    {
+        channel->enableWriting();
+    }
+}
+
+void RedisAsyncAdapter::delWrite(void *privdata)
+{
+    Channel *channel = static_cast<RedisAsyncAdapter *>(privdata)->_channel.get();
+    if (channel->isWriting())
+    {
+        channel->disableWriting();
+    }
+}
+
+void RedisAsyncAdapter::cleanup(void *privdata)
+{
+    RedisAsyncAdapter *adapter = static_cast<RedisAsyncAdapter *>(privdata);
+    adapter->_context = nullptr;
+    adapter->_channel->disableAll();
+    adapter->_channel->remove();
+
+    // cleanup可能在Channel的事件回调中被调用，不能在这里直接析构Channel，放到本轮事件处理完之后
+    adapter->_loop->queueInLoop([adapter]() { delete adapter; });
+}
+
+void RedisAsyncAdapter::handleRead(Timestamp)
+{
+    if (_context != nullptr)
+    {
+        redisAsyncHandleRead(_context);
+    }
+}
+
+void RedisAsyncAdapter::handleWrite()
+{
+    if (_context != nullptr)
+    {
+        redisAsyncHandleWrite(_context);
+    }
+}
@@ -0,0 +1,47 @@
+#include "userconnectionmap.hpp"
+
+void UserConnectionMap::insert(int userid, const TcpConnectionPtr &conn,
+                               long long epoch) {
+    Shard &s = shard(userid);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.conns[userid] = Entry{conn, epoch};
+}
+
+bool UserConnectionMap::erase(int userid, const TcpConnectionPtr &conn) {
+    Shard &s = shard(userid);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.conns.find(userid);
+    if (it == s.conns.end() || it->second.conn != conn) {
+        return false;
+    }
+    s.conns.erase(it);
+    return true;
+}
+
+TcpConnectionPtr UserConnectionMap::find(int userid) const {
+    const Shard &s = shard(userid);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.conns.find(userid);
+    if (it == s.conns.end()) {
+        return TcpConnectionPtr();
+    }
+    return it->second.conn;
+}
+
+bool UserConnectionMap::contains(int userid, long long epoch) const {
+    const Shard &s = shard(userid);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.conns.find(userid);
+    return it != s.conns.end() && it->second.epoch == epoch;
+}
+
+void UserConnectionMap::forEach(
+    const std::function<void(int, const TcpConnectionPtr &, long long)> &fn)
+    const {
+    for (const Shard &s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (const auto &entry : s.conns) {
+            fn(entry.first, entry.second.conn, entry.second.epoch);
+        }
+    }
+}
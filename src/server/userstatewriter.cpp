@@ -0,0 +1,97 @@
+#include "userstatewriter.hpp"
+
+#include <muduo/base/Logging.h>
+
+// 缓冲的时间窗口(ms)
+static const int kFlushInterval = 100;
+// 缓冲的用户数达到该值时立即写入
+static const size_t kFlushThreshold = 1000;
+
+UserStateWriter::UserStateWriter()
+    : flusher_(kFlushInterval, [this]() { return write(); }) {}
+
+void UserStateWriter::update(int userid, long long epoch,
+                             const std::string &state) {
+    update(std::vector<std::pair<int, long long>>{{userid, epoch}}, state);
+}
+
+void UserStateWriter::update(
+    const std::vector<std::pair<int, long long>> &sessions,
+    const std::string &state) {
+    if (sessions.empty()) {
+        return;
+    }
+
+    bool full = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 同一用户在一个时间窗口内的多次上下线只保留最后一次
+        // 其它节点上之前那次登录的状态到得晚时，不覆盖之后登录的状态
+        for (const auto &session : sessions) {
+            auto it = pending_.find(session.first);
+            if (it == pending_.end()) {
+                pending_.emplace(session.first,
+                                 PendingState{state, session.second});
+            } else if (it->second.epoch <= session.second) {
+                it->second = PendingState{state, session.second};
+            }
+        }
+        full = pending_.size() >= kFlushThreshold;
+    }
+    flusher_.added(full);
+}
+
+std::string UserStateWriter::state(int userid, const std::string &stored) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.find(userid);
+    if (it != pending_.end()) {
+        return it->second.state;
+    }
+    it = flushing_.find(userid);
+    if (it != flushing_.end()) {
+        return it->second.state;
+    }
+    return stored;
+}
+
+bool UserStateWriter::write() {
+    // 按状态分组，每种状态用一批带纪元条件的update写入
+    std::unordered_map<std::string, std::vector<std::pair<int, long long>>>
+        stateSessions;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) {
+            return true;
+        }
+        flushing_.swap(pending_);
+        for (const auto &entry : flushing_) {
+            stateSessions[entry.second.state].emplace_back(
+                entry.first, entry.second.epoch);
+        }
+    }
+
+    std::vector<const std::string *> failed;
+    for (const auto &entry : stateSessions) {
+        if (!userModel_.updateState(entry.second, entry.first)) {
+            LOG_ERROR << "write " << entry.second.size() << " user states '"
+                      << entry.first << "' failed, retry later!";
+            failed.push_back(&entry.first);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 写入失败的状态放回缓冲区，写入期间又有更新的用户以纪元较新的状态为准
+    for (const std::string *state : failed) {
+        for (const auto &session : stateSessions[*state]) {
+            auto it = pending_.find(session.first);
+            if (it == pending_.end()) {
+                pending_.emplace(session.first,
+                                 PendingState{*state, session.second});
+            } else if (it->second.epoch < session.second) {
+                it->second = PendingState{*state, session.second};
+            }
+        }
+    }
+    flushing_.clear();
+    return failed.empty();
+}
@@ -0,0 +1,60 @@
+#include "workerpool.hpp"
+
+WorkerPool::WorkerPool(int threadNum) {
+    for (int i = 0; i < threadNum; ++i) {
+        workers_.emplace_back(new Worker);
+    }
+}
+
+WorkerPool::~WorkerPool() { stop(); }
+
+void WorkerPool::start() {
+    for (auto &worker : workers_) {
+        worker->thread =
+            std::thread(&WorkerPool::workerThread, this, worker.get());
+    }
+}
+
+void WorkerPool::stop() {
+    for (auto &worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->stop = true;
+        }
+        worker->cv.notify_one();
+    }
+
+    for (auto &worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+void WorkerPool::run(size_t key, Task task) {
+    Worker *worker = workers_[key % workers_.size()].get();
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->tasks.push_back(std::move(task));
+    }
+    worker->cv.notify_one();
+}
+
+void WorkerPool::workerThread(Worker *worker) {
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->cv.wait(lock, [worker]() {
+                return worker->stop || !worker->tasks.empty();
+            });
+            // 停止前把队列中剩余的任务执行完
+            if (worker->tasks.empty()) {
+                return;
+            }
+            task = std::move(worker->tasks.front());
+            worker->tasks.pop_front();
+        }
+        task();
+    }
+}